@@ -0,0 +1,91 @@
+#include <cstdio>
+#include <iomanip>
+
+#include "bench.hpp"
+
+static void write_json_string(std::ostream &out, const std::string &value) {
+    out << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<u8>(c) < 0x20u) {
+            char escaped[8]{};
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<u32>(static_cast<u8>(c)));
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+BenchRunner::BenchRunner(const BenchConfig &config) : _config(config) {
+    if (_config.repetitions == 0u) {
+        _config.repetitions = 1u;
+    }
+}
+
+bool BenchRunner::is_enabled(const std::string &name) const {
+    return _config.filter.empty() || name.find(_config.filter) != std::string::npos;
+}
+
+const std::vector<BenchResult> &BenchRunner::results() const {
+    return _results;
+}
+
+static f64 get_median(std::vector<f64> &values) {
+    std::sort(values.begin(), values.end());
+
+    usize mid = values.size() / 2u;
+    return values.size() % 2u == 1u ? values[mid] : (values[mid - 1u] + values[mid]) * 0.5;
+}
+
+void BenchRunner::add_result(const std::string &name, u64 iterations, u64 items_per_iteration, std::vector<f64> &repetition_ns, std::vector<f64> &cpu_repetition_ns) {
+    f64 median = get_median(repetition_ns);
+
+    _results.push_back(BenchResult{
+        .name = name,
+        .iterations = iterations,
+        .items_per_iteration = items_per_iteration,
+        .median_ns = median,
+        .min_ns = repetition_ns.front(),
+        .max_ns = repetition_ns.back(),
+        .cpu_median_ns = get_median(cpu_repetition_ns)
+    });
+
+    const BenchResult &result = _results.back();
+    // Progress goes to stderr, stdout may be the JSON
+    std::fprintf(stderr, "%-56s %14.1f ns %14.1f ns %10llu\n", result.name.c_str(), result.median_ns, result.min_ns, static_cast<unsigned long long>(result.iterations));
+}
+
+void BenchRunner::write_json(std::ostream &out, const std::vector<std::pair<std::string, std::string>> &context) const {
+    out << "{\n  \"context\": {\n";
+    for (usize i{}; i < context.size(); ++i) {
+        out << "    ";
+        write_json_string(out, context[i].first);
+        out << ": ";
+        write_json_string(out, context[i].second);
+        out << (i + 1u < context.size() ? ",\n" : "\n");
+    }
+    out << "  },\n  \"benchmarks\": [\n";
+
+    out << std::setprecision(17);
+    for (usize i{}; i < _results.size(); ++i) {
+        const BenchResult &result = _results[i];
+        f64 items_per_second = result.median_ns > 0.0 ? static_cast<f64>(result.items_per_iteration) * 1e9 / result.median_ns : 0.0;
+
+        out << "    {\n      \"name\": ";
+        write_json_string(out, result.name);
+        out << ",\n      \"run_type\": \"aggregate\",\n      \"aggregate_name\": \"median\"";
+        out << ",\n      \"repetitions\": " << _config.repetitions;
+        out << ",\n      \"iterations\": " << result.iterations;
+        out << ",\n      \"real_time\": " << result.median_ns;
+        out << ",\n      \"cpu_time\": " << result.cpu_median_ns;
+        out << ",\n      \"min_time\": " << result.min_ns;
+        out << ",\n      \"max_time\": " << result.max_ns;
+        out << ",\n      \"time_unit\": \"ns\"";
+        out << ",\n      \"items_per_second\": " << items_per_second;
+        out << "\n    }" << (i + 1u < _results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
@@ -0,0 +1,122 @@
+#ifndef SIMD_EXPERIMENT_BENCH_HPP
+#define SIMD_EXPERIMENT_BENCH_HPP
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <chrono>
+#include <utility>
+#include <ostream>
+#include <algorithm>
+
+#include "types.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+struct BenchConfig {
+    // Only benchmarks whose name contains this are run, empty runs everything
+    std::string filter{};
+
+    // Every benchmark is repeated this many times, the median repetition is reported
+    u32 repetitions = 5u;
+
+    // Total time every benchmark should run for, the iteration count of a repetition is picked accordingly
+    f64 min_time_ms = 100.0;
+};
+
+struct BenchResult {
+    std::string name{};
+    u64 iterations{};
+    u64 items_per_iteration{};
+
+    // Wall time per iteration, over the repetitions
+    f64 median_ns{};
+    f64 min_ns{};
+    f64 max_ns{};
+
+    // Process CPU time per iteration, the median repetition
+    f64 cpu_median_ns{};
+};
+
+// Keeps the compiler from dropping a computation whose result is never read
+template <typename T>
+inline void do_not_optimize(const T &value) {
+#ifdef _MSC_VER
+    const volatile void *sink = &value;
+    (void) sink;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// Writes back everything the compiler kept in registers, e.g. after filling a buffer that is never read
+inline void clobber_memory() {
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+class BenchRunner {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit BenchRunner(const BenchConfig &config);
+
+    // Runs body(iterations) with an iteration count picked so that every repetition takes a share of min_time_ms.
+    // items_per_iteration is only reported, e.g. as the number of patches or vectors one iteration processes.
+    template <typename Body>
+    void run(const std::string &name, u64 items_per_iteration, const Body &body);
+
+    bool is_enabled(const std::string &name) const;
+
+    const std::vector<BenchResult> &results() const;
+
+    // Same layout as Google Benchmark's --benchmark_format=json, so the same tooling can compare the results.
+    // `context` entries are added to the context object as strings.
+    void write_json(std::ostream &out, const std::vector<std::pair<std::string, std::string>> &context) const;
+
+private:
+    void add_result(const std::string &name, u64 iterations, u64 items_per_iteration, std::vector<f64> &repetition_ns, std::vector<f64> &cpu_repetition_ns);
+
+    BenchConfig _config{};
+    std::vector<BenchResult> _results{};
+};
+
+template <typename Body>
+void BenchRunner::run(const std::string &name, u64 items_per_iteration, const Body &body) {
+    if (!is_enabled(name)) {
+        return;
+    }
+
+    auto time_ns = [&](u64 iterations) {
+        auto start = Clock::now();
+        body(iterations);
+        return static_cast<f64>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    };
+
+    // Warms the caches and finds an iteration count filling a repetition's share of the time
+    const f64 repetition_ns = _config.min_time_ms * 1e6 / static_cast<f64>(_config.repetitions);
+
+    u64 iterations = 1u;
+    for (f64 elapsed = time_ns(iterations); elapsed < repetition_ns; elapsed = time_ns(iterations)) {
+        f64 scale = elapsed > 0.0 ? repetition_ns / elapsed : 10.0;
+        iterations = static_cast<u64>(static_cast<f64>(iterations) * std::min(std::max(scale * 1.2, 1.5), 10.0)) + 1u;
+    }
+
+    std::vector<f64> repetitions{};
+    std::vector<f64> cpu_repetitions{};
+    for (u32 i{}; i < _config.repetitions; ++i) {
+        std::clock_t cpu_start = std::clock();
+        repetitions.push_back(time_ns(iterations) / static_cast<f64>(iterations));
+        cpu_repetitions.push_back(static_cast<f64>(std::clock() - cpu_start) * 1e9 / static_cast<f64>(CLOCKS_PER_SEC) / static_cast<f64>(iterations));
+    }
+
+    add_result(name, iterations, items_per_iteration, repetitions, cpu_repetitions);
+}
+
+#endif
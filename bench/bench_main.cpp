@@ -0,0 +1,854 @@
+#include <array>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#include "bench.hpp"
+#include "math/math.hpp"
+#include "raster.hpp"
+#include "raster_pipeline.hpp"
+#include "raster_kernels.hpp"
+#include "command_list.hpp"
+#include "ply_importer.hpp"
+#include "scene_generator.hpp"
+
+static constexpr usize VEC_COUNT = 1024u;
+static constexpr usize MAT_COUNT = 256u;
+static constexpr usize FILL_RECT_COUNT = 4096u;
+static constexpr usize TRANSFORM_PATCH_COUNT = 65536u;
+
+static constexpr u32 FILL_TARGET_WIDTH = 960u;
+static constexpr u32 FILL_TARGET_HEIGHT = 540u;
+
+// Same seed every run, so every run measures the same inputs
+static constexpr u32 BENCH_SEED = 0x5EEDu;
+
+struct FillRect {
+    i32 min_x_i{}, min_y_i{}, max_x_i{}, max_y_i{};
+    u32 color32{};
+    u32 depth32{};
+};
+
+// Side lengths of the rects in pixels, both inclusive
+struct PatchSizeDistribution {
+    const char *name{};
+    i32 min_size{};
+    i32 max_size{};
+};
+
+static constexpr PatchSizeDistribution PATCH_SIZE_DISTRIBUTIONS[] = {
+    { "tiny", 1, 2 },
+    { "small", 3, 8 },
+    { "medium", 9, 32 },
+    { "large", 33, 128 }
+};
+
+struct FrameScene {
+    const char *name{};
+    i32 instances_per_side{};
+    vec3 eye{};
+    vec3 target{};
+};
+
+static constexpr FrameScene FRAME_SCENES[] = {
+    { "tree", 1, vec3(2.0f, 3.0f, 4.0f), vec3(0.0f, 1.5f, 0.0f) },
+    { "forest", 30, vec3(3.0f, 8.0f, 30.0f), vec3(0.0f, 0.0f, 0.0f) }
+};
+
+static constexpr u32 FRAME_RESOLUTIONS[][2] = {
+    { 480u, 270u },
+    { 960u, 540u },
+    { 1920u, 1080u }
+};
+
+static const char *get_simd_mode() {
+#if defined(MATH_SIMD_RUNTIME_DISPATCH)
+    return "dispatch";
+#elif defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+    return "avx";
+#elif defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_SSE)
+    return "sse";
+#else
+    return "scalar";
+#endif
+}
+
+static const char *get_compiler() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+template <typename T, typename Fn>
+static void bench_math(BenchRunner &runner, const std::string &name, usize count, const Fn &fn) {
+    static std::vector<T> out{};
+    out.resize(count);
+
+    runner.run(name, count, [&](u64 iterations) {
+        for (u64 it{}; it < iterations; ++it) {
+            for (usize i{}; i < count; ++i) {
+                out[i] = fn(i);
+            }
+            clobber_memory();
+        }
+    });
+}
+
+static void bench_vec4(BenchRunner &runner) {
+    std::mt19937 rng(BENCH_SEED);
+    std::uniform_real_distribution<f32> value(0.5f, 2.0f);
+
+    std::vector<vec4> a(VEC_COUNT), b(VEC_COUNT);
+    for (usize i{}; i < VEC_COUNT; ++i) {
+        a[i] = vec4(value(rng), value(rng), value(rng), value(rng));
+        b[i] = vec4(value(rng), value(rng), value(rng), value(rng));
+    }
+
+    const f32 s = value(rng);
+
+    bench_math<vec4>(runner, "math/vec4/add", VEC_COUNT, [&](usize i) { return a[i] + b[i]; });
+    bench_math<vec4>(runner, "math/vec4/sub", VEC_COUNT, [&](usize i) { return a[i] - b[i]; });
+    bench_math<vec4>(runner, "math/vec4/mul", VEC_COUNT, [&](usize i) { return a[i] * b[i]; });
+    bench_math<vec4>(runner, "math/vec4/div", VEC_COUNT, [&](usize i) { return a[i] / b[i]; });
+    bench_math<vec4>(runner, "math/vec4/add_scalar", VEC_COUNT, [&](usize i) { return a[i] + s; });
+    bench_math<vec4>(runner, "math/vec4/sub_scalar", VEC_COUNT, [&](usize i) { return a[i] - s; });
+    bench_math<vec4>(runner, "math/vec4/mul_scalar", VEC_COUNT, [&](usize i) { return a[i] * s; });
+    bench_math<vec4>(runner, "math/vec4/div_scalar", VEC_COUNT, [&](usize i) { return a[i] / s; });
+    bench_math<vec4>(runner, "math/vec4/min", VEC_COUNT, [&](usize i) { return a[i].min(b[i]); });
+    bench_math<vec4>(runner, "math/vec4/max", VEC_COUNT, [&](usize i) { return a[i].max(b[i]); });
+    bench_math<f32>(runner, "math/vec4/dot", VEC_COUNT, [&](usize i) { return a[i].dot(b[i]); });
+    bench_math<f32>(runner, "math/vec4/magnitude", VEC_COUNT, [&](usize i) { return a[i].magnitude(); });
+    bench_math<vec4>(runner, "math/vec4/normalized", VEC_COUNT, [&](usize i) { return a[i].normalized(); });
+}
+
+static void bench_mat4(BenchRunner &runner) {
+    std::mt19937 rng(BENCH_SEED);
+    std::uniform_real_distribution<f32> value(0.5f, 2.0f);
+
+    std::vector<mat4> a(MAT_COUNT), b(MAT_COUNT);
+    for (usize i{}; i < MAT_COUNT; ++i) {
+        for (u32 c{}; c < 4u; ++c) {
+            for (u32 r{}; r < 4u; ++r) {
+                a[i].m[c][r] = value(rng);
+                b[i].m[c][r] = value(rng);
+            }
+        }
+    }
+
+    std::vector<vec4> v(MAT_COUNT);
+    for (vec4 &vec : v) {
+        vec = vec4(value(rng), value(rng), value(rng), 1.0f);
+    }
+
+    const f32 s = value(rng);
+
+    bench_math<mat4>(runner, "math/mat4/add_scalar", MAT_COUNT, [&](usize i) { return a[i] + s; });
+    bench_math<mat4>(runner, "math/mat4/sub_scalar", MAT_COUNT, [&](usize i) { return a[i] - s; });
+    bench_math<mat4>(runner, "math/mat4/mul_scalar", MAT_COUNT, [&](usize i) { return a[i] * s; });
+    bench_math<mat4>(runner, "math/mat4/div_scalar", MAT_COUNT, [&](usize i) { return a[i] / s; });
+    bench_math<mat4>(runner, "math/mat4/add_assign_scalar", MAT_COUNT, [&](usize i) { mat4 m = a[i]; return m += s; });
+    bench_math<mat4>(runner, "math/mat4/sub_assign_scalar", MAT_COUNT, [&](usize i) { mat4 m = a[i]; return m -= s; });
+    bench_math<mat4>(runner, "math/mat4/mul_assign_scalar", MAT_COUNT, [&](usize i) { mat4 m = a[i]; return m *= s; });
+    bench_math<mat4>(runner, "math/mat4/div_assign_scalar", MAT_COUNT, [&](usize i) { mat4 m = a[i]; return m /= s; });
+    bench_math<mat4>(runner, "math/mat4/mul_mat4", MAT_COUNT, [&](usize i) { return a[i] * b[i]; });
+    bench_math<vec4>(runner, "math/mat4/mul_vec4", MAT_COUNT, [&](usize i) { return a[i] * v[i]; });
+}
+
+static std::vector<FillRect> make_fill_rects(const PatchSizeDistribution &distribution) {
+    std::mt19937 rng(BENCH_SEED);
+    std::uniform_int_distribution<i32> size(distribution.min_size, distribution.max_size);
+    std::uniform_int_distribution<u32> value(0u, UINT32_MAX - 1u);
+
+    std::vector<FillRect> rects(FILL_RECT_COUNT);
+    for (FillRect &rect : rects) {
+        i32 size_x = size(rng);
+        i32 size_y = size(rng);
+
+        rect.min_x_i = std::uniform_int_distribution<i32>(0, static_cast<i32>(FILL_TARGET_WIDTH) - size_x)(rng);
+        rect.min_y_i = std::uniform_int_distribution<i32>(0, static_cast<i32>(FILL_TARGET_HEIGHT) - size_y)(rng);
+        rect.max_x_i = rect.min_x_i + size_x;
+        rect.max_y_i = rect.min_y_i + size_y;
+        rect.color32 = value(rng);
+        rect.depth32 = value(rng);
+    }
+
+    return rects;
+}
+
+// The depth tested fills run against the depth the previous iteration left behind, like overdraw within a frame
+static void bench_fills(BenchRunner &runner) {
+    DynamicFramebuffer color{}, depth{};
+    color.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+    depth.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+
+    const RenderTarget color_target = color.target();
+    const RenderTarget depth_target = depth.target();
+
+    for (const PatchSizeDistribution &distribution : PATCH_SIZE_DISTRIBUTIONS) {
+        const std::vector<FillRect> rects = make_fill_rects(distribution);
+        const std::string suffix = std::string("/") + distribution.name;
+
+        auto bench_fill = [&](const std::string &name, u32 depth_clear, const auto &fill) {
+            if (!runner.is_enabled(name + suffix)) {
+                return;
+            }
+
+            color_target.fill(0u);
+            depth_target.fill(depth_clear);
+
+            runner.run(name + suffix, rects.size(), [&](u64 iterations) {
+                for (u64 it{}; it < iterations; ++it) {
+                    for (const FillRect &rect : rects) {
+                        fill(rect);
+                    }
+                    clobber_memory();
+                }
+            });
+        };
+
+        bench_fill("fill/fill_patch_color", UINT32_MAX, [&](const FillRect &r) {
+            raster::detail::fill_patch_color(color_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.color32);
+        });
+        bench_fill("fill/fill_patch_depth", UINT32_MAX, [&](const FillRect &r) {
+            raster::detail::fill_patch_depth(depth_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.depth32);
+        });
+        bench_fill("fill/fill_patch_color_depth", UINT32_MAX, [&](const FillRect &r) {
+            raster::detail::fill_patch_color_depth(color_target, depth_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.color32, r.depth32);
+        });
+        // Every rect's depth is the cleared one, so every pixel passes
+        bench_fill("fill/fill_patch_color_depth_equal", rects[0].depth32, [&](const FillRect &r) {
+            raster::detail::fill_patch_color_depth_equal(color_target, depth_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.color32, rects[0].depth32);
+        });
+        // What the pipelines actually call, including the splat of tiny patches
+        bench_fill("fill/fill_fragment", UINT32_MAX, [&](const FillRect &r) {
+            PatchFragment fragment{ r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.color32, r.depth32 };
+            raster::detail::fill_fragment<PipelineState{}>(fragment, color_target, depth_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i);
+        });
+    }
+}
+
+// Every kernel of every tier the build contains and the CPU supports, called through its table like the dispatched
+// pipeline does
+static void bench_kernels(BenchRunner &runner) {
+    DynamicFramebuffer color{}, depth{};
+    color.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+    depth.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+
+    const RenderTarget color_target = color.target();
+    const RenderTarget depth_target = depth.target();
+
+    std::vector<Patch> patches(TRANSFORM_PATCH_COUNT);
+    SceneGenerator(SceneGeneratorConfig{ .patch_count = TRANSFORM_PATCH_COUNT }, FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT).generate(0u, patches);
+
+    const mat4 transform = mat4::perspective(1.0f, 16.0f / 9.0f, 0.1f, 100.0f) * mat4::look_at(vec3(0.0f, 0.0f, -2.0f), vec3(0.0f));
+    std::vector<vec4> ndc(patches.size() * 3u);
+
+    // Shaded colors, some of them out of range so that the saturation is part of the measurement
+    std::vector<vec4> colors(patches.size());
+    std::vector<u32> packed(patches.size());
+    for (usize i{}; i < patches.size(); ++i) {
+        colors[i] = vec4(patches[i].color * 1.25f - vec3(0.1f), 1.0f);
+    }
+
+    for (u32 tier{}; tier < SIMD_TIER_COUNT; ++tier) {
+        const raster::RasterKernels *kernels = raster::get_raster_kernels(static_cast<SimdTier>(tier));
+        if (kernels == nullptr) {
+            continue;
+        }
+
+        const std::string prefix = std::string("kernels/") + get_simd_tier_name(kernels->tier) + "/";
+
+        if (runner.is_enabled(prefix + "transform_patches")) {
+            runner.run(prefix + "transform_patches", patches.size(), [&](u64 iterations) {
+                for (u64 it{}; it < iterations; ++it) {
+                    kernels->transform_patches(patches.data(), patches.size(), transform, ndc.data());
+                    clobber_memory();
+                }
+            });
+        }
+
+        if (runner.is_enabled(prefix + "pack_colors")) {
+            runner.run(prefix + "pack_colors", colors.size(), [&](u64 iterations) {
+                for (u64 it{}; it < iterations; ++it) {
+                    kernels->pack_colors(colors.data(), colors.size(), packed.data());
+                    clobber_memory();
+                }
+            });
+        }
+
+        for (const PatchSizeDistribution &distribution : PATCH_SIZE_DISTRIBUTIONS) {
+            const std::vector<FillRect> rects = make_fill_rects(distribution);
+            const std::string suffix = std::string("/") + distribution.name;
+
+            auto bench_fill = [&](const std::string &name, u32 depth_clear, const auto &fill) {
+                if (!runner.is_enabled(prefix + name + suffix)) {
+                    return;
+                }
+
+                color_target.fill(0u);
+                depth_target.fill(depth_clear);
+
+                runner.run(prefix + name + suffix, rects.size(), [&](u64 iterations) {
+                    for (u64 it{}; it < iterations; ++it) {
+                        for (const FillRect &rect : rects) {
+                            fill(rect);
+                        }
+                        clobber_memory();
+                    }
+                });
+            };
+
+            bench_fill("fill_patch_color", UINT32_MAX, [&](const FillRect &r) {
+                kernels->fill_patch_color(color_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.color32);
+            });
+            bench_fill("fill_patch_depth", UINT32_MAX, [&](const FillRect &r) {
+                kernels->fill_patch_depth(depth_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.depth32);
+            });
+            bench_fill("fill_patch_color_depth", UINT32_MAX, [&](const FillRect &r) {
+                kernels->fill_patch_color_depth(color_target, depth_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.color32, r.depth32);
+            });
+            bench_fill("fill_patch_color_depth_equal", rects[0].depth32, [&](const FillRect &r) {
+                kernels->fill_patch_color_depth_equal(color_target, depth_target, r.min_x_i, r.min_y_i, r.max_x_i, r.max_y_i, r.color32, rects[0].depth32);
+            });
+        }
+    }
+}
+
+static void bench_ply_import(BenchRunner &runner) {
+    for (u64 patch_count : { 8192u, 131072u }) {
+        const std::string suffix = "/faces:" + std::to_string(patch_count);
+
+        if (!runner.is_enabled("ply_import/patches" + suffix) && !runner.is_enabled("ply_import/mesh" + suffix)) {
+            continue;
+        }
+
+        const SceneGenerator generator(SceneGeneratorConfig{ .patch_count = patch_count, .seed = BENCH_SEED }, FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+
+        std::filesystem::path path = std::filesystem::temp_directory_path() / ("simd_experiment_bench_" + std::to_string(patch_count) + ".ply");
+        if (!generator.write_ply(path.string())) {
+            std::cerr << "Failed to write the generated scene to \"" << path.string() << "\"\n";
+            continue;
+        }
+
+        // ply_import() reports the element counts on stdout, which would end up in the JSON
+        std::cout.setstate(std::ios::failbit);
+
+        std::vector<Patch> patches{};
+        runner.run("ply_import/patches" + suffix, patch_count, [&](u64 iterations) {
+            for (u64 it{}; it < iterations; ++it) {
+                patches.clear();
+                ply_import(path.string(), patches);
+                clobber_memory();
+            }
+        });
+
+        Mesh mesh{};
+        runner.run("ply_import/mesh" + suffix, patch_count, [&](u64 iterations) {
+            for (u64 it{}; it < iterations; ++it) {
+                ply_import(path.string(), mesh);
+                clobber_memory();
+            }
+        });
+
+        std::cout.clear();
+        std::filesystem::remove(path);
+    }
+}
+
+// Generated scenes drawn at the resolution they were generated for, scaling with the patch count at a fixed overdraw
+// and with the overdraw at a fixed patch count, for every depth order
+static void bench_scenes(BenchRunner &runner) {
+    struct SceneCase {
+        std::string name{};
+        SceneGeneratorConfig config{};
+    };
+
+    std::vector<SceneCase> cases{};
+    for (u64 patch_count : { 1000u, 10000u, 100000u, 1000000u }) {
+        cases.push_back(SceneCase{ "scene/patches:" + std::to_string(patch_count), SceneGeneratorConfig{ .patch_count = patch_count, .seed = BENCH_SEED } });
+    }
+
+    const std::pair<const char *, SceneDepthOrder> depth_orders[] = {
+        { "random", SceneDepthOrder::Random },
+        { "back_to_front", SceneDepthOrder::BackToFront },
+        { "front_to_back", SceneDepthOrder::FrontToBack }
+    };
+    for (u32 overdraw : { 1u, 4u, 16u }) {
+        for (const auto &[order_name, depth_order] : depth_orders) {
+            cases.push_back(SceneCase{
+                "scene/overdraw:" + std::to_string(overdraw) + "/" + order_name,
+                SceneGeneratorConfig{ .patch_count = 100000u, .overdraw = static_cast<f32>(overdraw), .depth_order = depth_order, .seed = BENCH_SEED }
+            });
+        }
+    }
+
+    DynamicFramebuffer color{}, depth{};
+    color.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+    depth.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+
+    // The patches are generated in NDC
+    const mat4 identity(1.0f);
+
+    auto patch_shader = [](const Patch &patch, const vec4 &avg_ndc, const mat4 &model, const vec3 &normal) {
+        return vec4(patch.color, 1.0f);
+    };
+
+    Mesh mesh{};
+    for (const SceneCase &scene_case : cases) {
+        if (!runner.is_enabled(scene_case.name)) {
+            continue;
+        }
+
+        SceneGenerator(scene_case.config, FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT).generate(mesh);
+
+        runner.run(scene_case.name, scene_case.config.patch_count, [&](u64 iterations) {
+            for (u64 it{}; it < iterations; ++it) {
+                color.target().fill(0u);
+                depth.target().fill(UINT32_MAX);
+
+                raster::draw_instanced<PipelineState{}>(mesh, std::span<const mat4>(&identity, 1u), identity, patch_shader, color.target(), depth.target());
+                clobber_memory();
+            }
+        });
+    }
+}
+
+static bool import_tree(const std::string &res_dir, Mesh &tree) {
+    std::cout.setstate(std::ios::failbit);
+
+    bool imported = ply_import(res_dir + "/tree.ply", tree);
+
+    std::cout.clear();
+
+    return imported;
+}
+
+// Pixels that differ from the reference draw, reported to stderr
+static bool check_same_pixels(const std::string &name, const DynamicFramebuffer &expected, const DynamicFramebuffer &actual) {
+    usize mismatches{};
+    for (usize i{}; i < expected.data.size(); ++i) {
+        mismatches += actual.data[i] != expected.data[i];
+    }
+
+    if (mismatches == 0u) {
+        return true;
+    }
+
+    std::cerr << name << ": " << mismatches << " of " << expected.data.size() << " pixels differ from the reference draw\n";
+    return false;
+}
+
+static bool check_same_image(const std::string &name, const DynamicFramebuffer &expected_color, const DynamicFramebuffer &expected_depth,
+                             const DynamicFramebuffer &color, const DynamicFramebuffer &depth) {
+    bool color_matches = check_same_pixels(name + "/color", expected_color, color);
+    bool depth_matches = check_same_pixels(name + "/depth", expected_depth, depth);
+    return color_matches && depth_matches;
+}
+
+// The normals of a cube's faces through models that mirror it or scale it non-uniformly, which have to keep pointing
+// away from its center and stay unit length
+static bool check_normal_transforms() {
+    std::vector<Patch> faces{};
+    for (u32 axis{}; axis < 3u; ++axis) {
+        for (f32 sign : { -1.0f, 1.0f }) {
+            Patch face{};
+            face.normal = vec3(axis == 0u ? sign : 0.0f, axis == 1u ? sign : 0.0f, axis == 2u ? sign : 0.0f);
+            faces.push_back(face);
+        }
+    }
+
+    mat4 mirror_x(1.0f);
+    mirror_x.m[0][0] = -1.0f;
+
+    // Scaled up and moved as well, neither of which may change the direction
+    mat4 mirror_z_scaled(2.0f);
+    mirror_z_scaled.m[2][2] = -2.0f;
+    mirror_z_scaled.m[3][0] = 5.0f;
+    mirror_z_scaled.m[3][3] = 1.0f;
+
+    mat4 non_uniform(1.0f);
+    non_uniform.m[1][1] = 4.0f;
+    non_uniform.m[2][2] = 0.5f;
+
+    const std::pair<const char *, mat4> models[] = {
+        { "mirror_x", mirror_x },
+        { "mirror_z_scaled", mirror_z_scaled },
+        { "non_uniform", non_uniform }
+    };
+
+    bool all_correct = true;
+    std::vector<vec3> normals(faces.size());
+    for (const auto &[name, model] : models) {
+        raster::transform_normals(faces, raster::get_normal_matrix(model), normals);
+
+        for (usize i{}; i < faces.size(); ++i) {
+            // The face's center is at its normal, the cube's center at the origin
+            vec3 center = (model * vec4(faces[i].normal, 0.0f)).xyz();
+
+            if (!(normals[i].dot(center) > 0.0f)) {
+                std::cerr << "normals/" << name << ": the normal of face " << i << " points inwards\n";
+                all_correct = false;
+            }
+            if (!(std::abs(normals[i].magnitude() - 1.0f) < 1e-5f)) {
+                std::cerr << "normals/" << name << ": the normal of face " << i << " has a length of " << normals[i].magnitude() << "\n";
+                all_correct = false;
+            }
+        }
+    }
+
+    return all_correct;
+}
+
+struct TreeUniforms {
+    mat4 view_proj{};
+    vec3 sun_direction{};
+};
+
+static vec4 tree_vertex_shader(const vec4 &vertex, const TreeUniforms &uniforms) {
+    vec4 clip = uniforms.view_proj * vertex;
+    return clip / clip.w;
+}
+
+static vec4 tree_patch_shader(const Patch &patch, const vec4 &avg_ndc, const TreeUniforms &uniforms) {
+    return vec4(patch.color * (std::max(patch.normal.dot(uniforms.sun_direction), 0.0f) * 0.8f + 0.2f), 1.0f);
+}
+
+// Draw paths that have to give the same image as a single Less pass over the same patches. Each is compared pixel by
+// pixel against that pass before it is timed, returns false if any of them differs.
+static bool bench_draw_paths(BenchRunner &runner, const std::string &res_dir) {
+    const std::string names[] = { "draw/tree/z_prepass", "draw/tree/z_prepass_ties", "draw/tree/multiview:3", "draw/tree/command_list" };
+    if (std::none_of(std::begin(names), std::end(names), [&](const std::string &name) { return runner.is_enabled(name); })) {
+        return true;
+    }
+
+    Mesh tree{};
+    if (!import_tree(res_dir, tree)) {
+        std::cerr << "Failed to import \"" << res_dir << "/tree.ply\", skipping the draw path benchmarks\n";
+        return true;
+    }
+
+    const FrameScene &scene = FRAME_SCENES[0];
+    const mat4 view_proj = mat4::perspective(math::deg_to_rad(60.0f), static_cast<f32>(FILL_TARGET_WIDTH) / static_cast<f32>(FILL_TARGET_HEIGHT), 0.1f, 400.0f) *
+                           mat4::look_at(scene.eye, scene.target);
+    const vec3 sun_direction = vec3(0.55f, 1.5f, -1.1f).normalized();
+
+    auto vertex_shader = [&](const vec4 &vertex) {
+        vec4 clip = view_proj * vertex;
+        return clip / clip.w;
+    };
+    auto patch_shader = [&](const Patch &patch, const vec4 &avg_ndc) {
+        return vec4(patch.color * (std::max(patch.normal.dot(sun_direction), 0.0f) * 0.8f + 0.2f), 1.0f);
+    };
+
+    DynamicFramebuffer expected_color{}, expected_depth{}, color{}, depth{};
+    for (DynamicFramebuffer *framebuffer : { &expected_color, &expected_depth, &color, &depth }) {
+        framebuffer->resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+    }
+
+    auto clear = [](DynamicFramebuffer &color_buffer, DynamicFramebuffer &depth_buffer) {
+        color_buffer.target().fill(0u);
+        depth_buffer.target().fill(UINT32_MAX);
+    };
+
+    // Every patch a second time in the inverted color, where the first copy has to stay on top
+    std::vector<Patch> tied_patches = tree.patches;
+    for (Patch patch : tree.patches) {
+        patch.color = vec3(1.0f) - patch.color;
+        tied_patches.push_back(patch);
+    }
+
+    bool all_match = true;
+    for (const auto &[name, patches] : { std::pair<std::string, std::span<const Patch>>{ names[0], tree.patches }, { names[1], tied_patches } }) {
+        if (!runner.is_enabled(name)) {
+            continue;
+        }
+
+        clear(expected_color, expected_depth);
+        raster::draw_patches<PipelineState{}>(patches, vertex_shader, patch_shader, expected_color.target(), expected_depth.target());
+
+        clear(color, depth);
+        raster::draw_patches_z_prepass<PipelineState{}>(patches, vertex_shader, patch_shader, color.target(), depth.target());
+        all_match &= check_same_image(name, expected_color, expected_depth, color, depth);
+
+        runner.run(name, patches.size(), [&](u64 iterations) {
+            for (u64 it{}; it < iterations; ++it) {
+                clear(color, depth);
+
+                raster::draw_patches_z_prepass<PipelineState{}>(patches, vertex_shader, patch_shader, color.target(), depth.target());
+                clobber_memory();
+            }
+        });
+    }
+
+    // The tree from three sides in one walk, against a separate draw per view
+    const f32 aspect = static_cast<f32>(FILL_TARGET_WIDTH) / static_cast<f32>(FILL_TARGET_HEIGHT);
+    const mat4 view_projs[] = {
+        view_proj,
+        mat4::perspective(math::deg_to_rad(60.0f), aspect, 0.1f, 400.0f) * mat4::look_at(vec3(-3.0f, 2.0f, 4.0f), scene.target),
+        mat4::perspective(math::deg_to_rad(70.0f), aspect, 0.1f, 400.0f) * mat4::look_at(vec3(0.0f, 6.0f, -5.0f), scene.target)
+    };
+    constexpr usize VIEW_COUNT = std::size(view_projs);
+
+    if (runner.is_enabled(names[2])) {
+        std::array<DynamicFramebuffer, VIEW_COUNT> view_colors{}, view_depths{};
+        std::array<RenderTarget, VIEW_COUNT> color_targets{}, depth_targets{};
+        for (usize view{}; view < VIEW_COUNT; ++view) {
+            view_colors[view].resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+            view_depths[view].resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+            color_targets[view] = view_colors[view].target();
+            depth_targets[view] = view_depths[view].target();
+        }
+
+        auto multiview_patch_shader = [&](const Patch &patch, const vec4 &avg_ndc, u32 view) {
+            return patch_shader(patch, avg_ndc);
+        };
+        auto draw_multiview = [&]() {
+            for (usize view{}; view < VIEW_COUNT; ++view) {
+                clear(view_colors[view], view_depths[view]);
+            }
+
+            raster::draw_patches_multiview<PipelineState{}>(tree.patches, view_projs, multiview_patch_shader, color_targets, depth_targets);
+        };
+
+        draw_multiview();
+        for (usize view{}; view < VIEW_COUNT; ++view) {
+            auto view_vertex_shader = [&](const vec4 &vertex) {
+                vec4 clip = view_projs[view] * vertex;
+                return clip / clip.w;
+            };
+
+            clear(expected_color, expected_depth);
+            raster::draw_patches<PipelineState{}>(tree.patches, view_vertex_shader, patch_shader, expected_color.target(), expected_depth.target());
+            all_match &= check_same_image(names[2] + "/view:" + std::to_string(view), expected_color, expected_depth, view_colors[view], view_depths[view]);
+        }
+
+        runner.run(names[2], VIEW_COUNT * tree.patches.size(), [&](u64 iterations) {
+            for (u64 it{}; it < iterations; ++it) {
+                draw_multiview();
+                clobber_memory();
+            }
+        });
+    }
+
+    // A recorded shadow pass and main pass replayed by the executor, against the same draws made directly. The main pass
+    // draws the tied patches in halves so that adjacent draws get merged, the inverted copy with a Z-prepass, and then
+    // half of the tree once more with a Z-prepass, where the later of the tied draws has to end up on top.
+    if (runner.is_enabled(names[3])) {
+        const u32 clear_color = raster::rgba_to_u32(vec4(0.6f, 0.8f, 1.0f, 0.0f));
+
+        const TreeUniforms uniforms[] = {
+            { view_proj, sun_direction },
+            { view_projs[2], sun_direction }
+        };
+        const void *const uniform_slots[] = { &uniforms[0], &uniforms[1] };
+
+        DrawPatchesConfig cfg{};
+        raster::bind_shaders<tree_vertex_shader, tree_patch_shader>(cfg, &uniforms[0]);
+
+        DrawPatchesConfig prepass_cfg = cfg;
+        prepass_cfg.enable_z_prepass = true;
+
+        const usize patch_count = tree.patches.size();
+        const std::pair<std::span<const Patch>, const DrawPatchesConfig *> main_draws[] = {
+            { std::span<const Patch>(tied_patches).subspan(0u, patch_count / 2u), &cfg },
+            { std::span<const Patch>(tied_patches).subspan(patch_count / 2u, patch_count - patch_count / 2u), &cfg },
+            { std::span<const Patch>(tied_patches).subspan(patch_count, patch_count / 2u), &prepass_cfg },
+            { std::span<const Patch>(tied_patches).subspan(patch_count + patch_count / 2u), &prepass_cfg },
+            { std::span<const Patch>(tied_patches).subspan(0u, patch_count / 2u), &prepass_cfg }
+        };
+
+        DynamicFramebuffer expected_shadow{}, shadow{};
+        expected_shadow.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+        shadow.resize(FILL_TARGET_WIDTH, FILL_TARGET_HEIGHT);
+
+        CommandList list{};
+        list.set_targets(RenderTarget{}, shadow.target());
+        list.clear(0u, UINT32_MAX);
+        list.draw(tree.patches, cfg, 1u);
+        list.barrier();
+        list.set_targets(color.target(), depth.target());
+        list.clear(clear_color, UINT32_MAX);
+        for (const auto &[patches, draw_cfg] : main_draws) {
+            list.draw(patches, *draw_cfg, 0u);
+        }
+
+        CommandExecutor executor{};
+        executor.execute(list, uniform_slots);
+
+        DrawPatchesConfig shadow_cfg = cfg;
+        shadow_cfg.uniforms = &uniforms[1];
+
+        expected_shadow.target().fill(UINT32_MAX);
+        raster::draw_patches(tree.patches, shadow_cfg, RenderTarget{}, expected_shadow.target());
+
+        expected_color.target().fill(clear_color);
+        expected_depth.target().fill(UINT32_MAX);
+        for (const auto &[patches, draw_cfg] : main_draws) {
+            raster::draw_patches(patches, *draw_cfg, expected_color.target(), expected_depth.target());
+        }
+
+        bool shadow_matches = check_same_pixels(names[3] + "/shadow", expected_shadow, shadow);
+        all_match &= check_same_image(names[3], expected_color, expected_depth, color, depth) && shadow_matches;
+
+        runner.run(names[3], patch_count * 3u + patch_count / 2u, [&](u64 iterations) {
+            for (u64 it{}; it < iterations; ++it) {
+                executor.execute(list, uniform_slots);
+                clobber_memory();
+            }
+        });
+    }
+
+    return all_match;
+}
+
+static void bench_frames(BenchRunner &runner, const std::string &res_dir) {
+    auto get_name = [](const FrameScene &scene, const u32 *resolution) {
+        return "frame/" + std::string(scene.name) + "/" + std::to_string(resolution[0]) + "x" + std::to_string(resolution[1]);
+    };
+
+    bool any_enabled = false;
+    for (const FrameScene &scene : FRAME_SCENES) {
+        for (const auto &resolution : FRAME_RESOLUTIONS) {
+            any_enabled |= runner.is_enabled(get_name(scene, resolution));
+        }
+    }
+    if (!any_enabled) {
+        return;
+    }
+
+    Mesh tree{};
+    if (!import_tree(res_dir, tree)) {
+        std::cerr << "Failed to import \"" << res_dir << "/tree.ply\", skipping the frame benchmarks\n";
+        return;
+    }
+
+    const vec3 sun_direction = vec3(0.55f, 1.5f, -1.1f).normalized();
+    const u32 clear_color = raster::rgba_to_u32(vec4(0.6f, 0.8f, 1.0f, 0.0f));
+
+    auto patch_shader = [&](const Patch &patch, const vec4 &avg_ndc, const mat4 &model, const vec3 &normal) {
+        return vec4(patch.color * (std::max(normal.dot(sun_direction), 0.0f) * 0.8f + 0.2f), 1.0f);
+    };
+
+    DynamicFramebuffer color{}, depth{};
+    for (const FrameScene &scene : FRAME_SCENES) {
+        std::vector<mat4> instances{};
+        for (i32 x{}; x < scene.instances_per_side; ++x) {
+            for (i32 z{}; z < scene.instances_per_side; ++z) {
+                mat4 model(1.0f);
+                model.m[3][0] = static_cast<f32>(x - scene.instances_per_side / 2) * 6.0f;
+                model.m[3][2] = static_cast<f32>(z - scene.instances_per_side / 2) * 6.0f;
+                instances.push_back(model);
+            }
+        }
+
+        for (const auto &resolution : FRAME_RESOLUTIONS) {
+            const std::string name = get_name(scene, resolution);
+            if (!runner.is_enabled(name)) {
+                continue;
+            }
+
+            color.resize(resolution[0], resolution[1]);
+            depth.resize(resolution[0], resolution[1]);
+
+            const mat4 view_proj = mat4::perspective(math::deg_to_rad(60.0f), static_cast<f32>(resolution[0]) / static_cast<f32>(resolution[1]), 0.1f, 400.0f) *
+                                   mat4::look_at(scene.eye, scene.target);
+
+            runner.run(name, instances.size() * tree.patches.size(), [&](u64 iterations) {
+                for (u64 it{}; it < iterations; ++it) {
+                    color.target().fill(clear_color);
+                    depth.target().fill(UINT32_MAX);
+
+                    raster::draw_instanced<PipelineState{}>(tree, instances, view_proj, patch_shader, color.target(), depth.target());
+                    clobber_memory();
+                }
+            });
+        }
+    }
+}
+
+static void print_usage() {
+    std::cerr << "Usage: simd_experiment_bench [--filter=<substring>] [--json=<path>] [--repetitions=<n>] [--min-time-ms=<ms>] [--res=<dir>]\n"
+              << "Writes the results as JSON to stdout unless --json is given, progress goes to stderr.\n"
+              << "Exits with 1 if a draw path gives a different image than the draw it is compared against, or if the\n"
+              << "normals of a mirrored or non-uniformly scaled model are wrong.\n";
+}
+
+i32 main(i32 argc, char **argv) {
+    BenchConfig config{};
+    std::string json_path{};
+    std::string res_dir = "res";
+
+    for (i32 i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        auto value_of = [&](const std::string &option) {
+            return arg.substr(option.size());
+        };
+
+        if (arg.starts_with("--filter=")) {
+            config.filter = value_of("--filter=");
+        } else if (arg.starts_with("--json=")) {
+            json_path = value_of("--json=");
+        } else if (arg.starts_with("--repetitions=")) {
+            config.repetitions = static_cast<u32>(std::stoul(value_of("--repetitions=")));
+        } else if (arg.starts_with("--min-time-ms=")) {
+            config.min_time_ms = std::stod(value_of("--min-time-ms="));
+        } else if (arg.starts_with("--res=")) {
+            res_dir = value_of("--res=");
+        } else {
+            print_usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    BenchRunner runner(config);
+
+    bench_vec4(runner);
+    bench_mat4(runner);
+    bench_fills(runner);
+    bench_kernels(runner);
+    bench_ply_import(runner);
+    bench_scenes(runner);
+    bool checks_passed = check_normal_transforms();
+    checks_passed &= bench_draw_paths(runner, res_dir);
+    bench_frames(runner, res_dir);
+
+    const std::vector<std::pair<std::string, std::string>> context{
+        { "executable", argv[0] },
+        { "simd", get_simd_mode() },
+        { "simd_kernels", get_simd_tier_name(raster::get_raster_kernels().tier) },
+        { "compiler", get_compiler() },
+        { "num_cpus", std::to_string(std::thread::hardware_concurrency()) },
+#ifdef NDEBUG
+        { "library_build_type", "release" },
+#else
+        { "library_build_type", "debug" },
+#endif
+        { "repetitions", std::to_string(config.repetitions) },
+        { "min_time_ms", std::to_string(config.min_time_ms) }
+    };
+
+    if (json_path.empty()) {
+        runner.write_json(std::cout, context);
+        return checks_passed ? 0 : 1;
+    }
+
+    std::ofstream file(json_path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open \"" << json_path << "\" for writing\n";
+        return 1;
+    }
+
+    runner.write_json(file, context);
+
+    return checks_passed ? 0 : 1;
+}
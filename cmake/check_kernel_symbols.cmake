@@ -0,0 +1,39 @@
+# Fails the build if a kernel object compiled for a newer instruction set defines weak symbols besides its own tier's
+# kernels. The linker may pick such a copy (an inline function, a std:: template) for every caller, also on CPUs without
+# the instruction set, see src/raster_kernels_avx2.cpp.
+# Usage: cmake -DNM=<nm> -DOBJECT_DIR=<target's object directory> -P check_kernel_symbols.cmake
+
+set(KERNEL_TIERS avx2 avx512)
+set(KERNEL_TIER_INDICES 2 3)
+
+set(LEAKS "")
+
+foreach(TIER_INDEX RANGE 1)
+    list(GET KERNEL_TIERS ${TIER_INDEX} TIER)
+    list(GET KERNEL_TIER_INDICES ${TIER_INDEX} TIER_VALUE)
+
+    file(GLOB_RECURSE OBJECTS "${OBJECT_DIR}/*raster_kernels_${TIER}.cpp.o" "${OBJECT_DIR}/*raster_kernels_${TIER}.cpp.obj")
+
+    foreach(OBJECT ${OBJECTS})
+        execute_process(
+            COMMAND ${NM} --defined-only -C ${OBJECT}
+            OUTPUT_VARIABLE SYMBOLS
+            RESULT_VARIABLE RESULT
+        )
+
+        if(NOT RESULT EQUAL 0)
+            message(FATAL_ERROR "Failed to list the symbols of ${OBJECT}")
+        endif()
+
+        string(REPLACE "\n" ";" SYMBOLS "${SYMBOLS}")
+        foreach(SYMBOL ${SYMBOLS})
+            if(SYMBOL MATCHES " [VWuvw] " AND NOT SYMBOL MATCHES "raster::detail::[a-z0-9_]+<\\(SimdTier\\)${TIER_VALUE}>")
+                string(APPEND LEAKS "\n  ${OBJECT}: ${SYMBOL}")
+            endif()
+        endforeach()
+    endforeach()
+endforeach()
+
+if(NOT LEAKS STREQUAL "")
+    message(FATAL_ERROR "Kernel objects define weak symbols other code may link against:${LEAKS}")
+endif()
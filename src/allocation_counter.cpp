@@ -0,0 +1,53 @@
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+#include "allocation_counter.hpp"
+
+#if !defined(NDEBUG)
+static thread_local bool t_counting{};
+static std::atomic<u64> g_allocation_count{};
+
+bool allocation_counter::is_counting() {
+    return t_counting;
+}
+
+void allocation_counter::set_counting(bool counting) {
+    t_counting = counting;
+}
+
+u64 allocation_counter::count() {
+    return g_allocation_count.load(std::memory_order_relaxed);
+}
+
+// The array, nothrow and sized variants all end up in these by default
+void *operator new(std::size_t size) {
+    if (t_counting) {
+        g_allocation_count.fetch_add(1u, std::memory_order_relaxed);
+    }
+
+    if (void *ptr = std::malloc(size != 0u ? size : 1u)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+#else
+bool allocation_counter::is_counting() {
+    return false;
+}
+
+void allocation_counter::set_counting(bool) {}
+
+u64 allocation_counter::count() {
+    return 0u;
+}
+#endif
@@ -0,0 +1,31 @@
+#ifndef SIMD_EXPERIMENT_ALLOCATION_COUNTER_HPP
+#define SIMD_EXPERIMENT_ALLOCATION_COUNTER_HPP
+
+#include "types.hpp"
+
+// Counts heap allocations, to check that steady-state frames don't allocate. Only builds without NDEBUG count, by
+// replacing the global operator new; elsewhere count() stays 0. Threads opt in, the worker pool passes the setting of
+// the thread calling run() on to the threads running its tasks. Aligned operator new is not counted.
+namespace allocation_counter {
+    // Whether the calling thread's allocations are counted
+    bool is_counting();
+    void set_counting(bool counting);
+
+    // Allocations of counting threads since the start of the program
+    u64 count();
+
+    // Counts the calling thread's allocations while it lives
+    class Scope {
+    public:
+        Scope() : _was_counting(is_counting()) { set_counting(true); }
+        ~Scope() { set_counting(_was_counting); }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        bool _was_counting{};
+    };
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include <atomic>
+#include <cassert>
+#include <algorithm>
+
+#include "arena.hpp"
+
+Arena::Arena(usize block_size) : _block_size(block_size) {
+    assert(block_size > 0u);
+}
+
+void *Arena::allocate(usize size, usize alignment) {
+    assert(alignment != 0u && (alignment & (alignment - 1u)) == 0u);
+
+    while (_block_index < _blocks.size()) {
+        Block &block = _blocks[_block_index];
+
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+        uintptr_t aligned = (base + _offset + alignment - 1u) & ~static_cast<uintptr_t>(alignment - 1u);
+        usize end = static_cast<usize>(aligned - base) + size;
+
+        if (end <= block.size) {
+            _used += end - _offset;
+            _offset = end;
+
+            return reinterpret_cast<void *>(aligned);
+        }
+
+        // Doesn't fit, the rest of this block stays unused until the next reset
+        ++_block_index;
+        _offset = 0u;
+    }
+
+    // Oversized allocations get a block of their own
+    usize block_size = std::max(_block_size, size + alignment);
+    _blocks.push_back(Block{
+        .data = std::make_unique<u8[]>(block_size),
+        .size = block_size
+    });
+
+    return allocate(size, alignment);
+}
+
+void Arena::reset() {
+    _block_index = 0u;
+    _offset = 0u;
+    _used = 0u;
+}
+
+Arena::Marker Arena::mark() const {
+    return Marker{
+        .block_index = _block_index,
+        .offset = _offset,
+        .used = _used
+    };
+}
+
+void Arena::rewind(const Marker &marker) {
+    assert(marker.used <= _used && "Rewinding to a marker from after the last reset!");
+
+    _block_index = marker.block_index;
+    _offset = marker.offset;
+    _used = marker.used;
+}
+
+usize Arena::used() const {
+    return _used;
+}
+
+static u64 next_frame_arena_generation() {
+    static std::atomic<u64> generation{ 1u };
+    return generation.fetch_add(1u, std::memory_order_relaxed);
+}
+
+FrameArena::FrameArena(usize block_size) : _block_size(block_size), _generation(next_frame_arena_generation()) {
+    assert(block_size > 0u);
+}
+
+Arena &FrameArena::local() {
+    struct LocalArena {
+        const FrameArena *owner{};
+        u64 generation{};
+        usize index{};
+        // Stays valid when other threads grow _arenas
+        Arena *arena{};
+    };
+    thread_local LocalArena cached{};
+
+    if (cached.owner == this && cached.generation == _generation) {
+        return *cached.arena;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    usize index = _arenas.size();
+    if (cached.owner == this && cached.index < _arenas.size() && _arenas[cached.index].generation != _generation) {
+        index = cached.index;
+    } else {
+        for (usize i{}; i < _arenas.size(); ++i) {
+            if (_arenas[i].generation != _generation) {
+                index = i;
+                break;
+            }
+        }
+    }
+
+    if (index == _arenas.size()) {
+        _arenas.push_back(SubArena{
+            .arena = std::make_unique<Arena>(_block_size)
+        });
+    }
+
+    _arenas[index].generation = _generation;
+
+    cached = LocalArena{
+        .owner = this,
+        .generation = _generation,
+        .index = index,
+        .arena = _arenas[index].arena.get()
+    };
+
+    return *cached.arena;
+}
+
+void FrameArena::reset() {
+    for (SubArena &sub_arena : _arenas) {
+        sub_arena.arena->reset();
+    }
+
+    _generation = next_frame_arena_generation();
+}
+
+usize FrameArena::used() const {
+    usize used{};
+    for (const SubArena &sub_arena : _arenas) {
+        used += sub_arena.arena->used();
+    }
+
+    return used;
+}
+
+FrameArena &get_frame_arena() {
+    static FrameArena frame_arena{};
+    return frame_arena;
+}
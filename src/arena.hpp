@@ -0,0 +1,134 @@
+#ifndef SIMD_EXPERIMENT_ARENA_HPP
+#define SIMD_EXPERIMENT_ARENA_HPP
+
+#include <new>
+#include <span>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#include "types.hpp"
+
+// Linear allocator for data that lives for a frame (or until the next reset), e.g. recorded commands.
+// Nothing is freed individually, reset() rewinds everything at once and keeps the blocks for reuse.
+class Arena {
+public:
+    static constexpr usize DEFAULT_BLOCK_SIZE = 64u * 1024u;
+
+    explicit Arena(usize block_size = DEFAULT_BLOCK_SIZE);
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    Arena(Arena &&) = default;
+    Arena &operator=(Arena &&) = default;
+
+    // Position to rewind() to, everything allocated after mark() is released at once
+    struct Marker {
+        usize block_index{};
+        usize offset{};
+        usize used{};
+    };
+
+    void *allocate(usize size, usize alignment);
+
+    // Destructors are never run, so only trivially destructible types are allowed
+    template <typename T, typename... Args>
+    T *create(Args &&...args);
+
+    // Uninitialized storage for `count` objects, for trivially copyable types the caller writes before reading
+    template <typename T>
+    std::span<T> allocate_array(usize count);
+
+    void reset();
+
+    Marker mark() const;
+    void rewind(const Marker &marker);
+
+    // Bytes handed out since the last reset, including alignment padding
+    usize used() const;
+
+private:
+    struct Block {
+        std::unique_ptr<u8[]> data{};
+        usize size{};
+    };
+
+    usize _block_size{};
+    std::vector<Block> _blocks{};
+    usize _block_index{};
+    usize _offset{};
+    usize _used{};
+};
+
+template <typename T, typename... Args>
+T *Arena::create(Args &&...args) {
+    static_assert(std::is_trivially_destructible_v<T>, "Arena objects are never destroyed!");
+
+    return new (allocate(sizeof(T), alignof(T))) T{ std::forward<Args>(args)... };
+}
+
+template <typename T>
+std::span<T> Arena::allocate_array(usize count) {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>, "Arena arrays are never constructed or destroyed!");
+
+    return std::span<T>(static_cast<T *>(allocate(sizeof(T) * count, alignof(T))), count);
+}
+
+// Scratch memory for the duration of a scope, everything allocated from the arena while it lives is released on exit
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena &arena) : _arena(arena), _marker(arena.mark()) {}
+    ~ArenaScope() { _arena.rewind(_marker); }
+
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    Arena &_arena;
+    Arena::Marker _marker{};
+};
+
+// Arena for the transient data of a frame, split into one sub-arena per thread so that threads never allocate from the
+// same one and don't have to lock. A thread claims a sub-arena on its first local() call after a reset, preferably the one
+// it had before, whose blocks already fit what it allocates. reset() rewinds all of them in O(1) each and keeps their
+// blocks, so steady-state frames don't touch the heap.
+// reset() must not run concurrently with local() or with the use of a sub-arena.
+class FrameArena {
+public:
+    explicit FrameArena(usize block_size = Arena::DEFAULT_BLOCK_SIZE);
+
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    // The calling thread's sub-arena until the next reset
+    Arena &local();
+
+    void reset();
+
+    // Bytes handed out by all sub-arenas since the last reset
+    usize used() const;
+
+private:
+    struct SubArena {
+        std::unique_ptr<Arena> arena{};
+        // Generation it was last claimed in
+        u64 generation{};
+    };
+
+    usize _block_size{};
+
+    std::mutex _mutex{};
+    std::vector<SubArena> _arenas{};
+
+    // Unique over all frame arenas and their resets, so a thread's cached sub-arena is never mistaken for a current one
+    u64 _generation{};
+};
+
+// Frame arena the raster library takes its scratch buffers from. They are released at the end of the call that used
+// them, so it doesn't grow if nobody resets it; the application resets it at the end of every frame.
+FrameArena &get_frame_arena();
+
+#endif
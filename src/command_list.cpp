@@ -0,0 +1,262 @@
+#include <cassert>
+#include <numeric>
+#include <algorithm>
+
+#include "command_list.hpp"
+#include "worker_pool.hpp"
+
+CommandList::CommandList(usize arena_block_size) : _arena(arena_block_size) {}
+
+void CommandList::reset() {
+    _arena.reset();
+    _first = nullptr;
+    _last = nullptr;
+    _command_count = 0u;
+}
+
+void CommandList::set_targets(const RenderTarget &color_target, const RenderTarget &depth_target) {
+    assert(color_target.valid() || depth_target.valid());
+
+    SetTargetsCommand *command = push<SetTargetsCommand>(CommandType::SetTargets);
+    command->color_target = color_target;
+    command->depth_target = depth_target;
+}
+
+void CommandList::clear(u32 clear_color, u32 clear_depth) {
+    ClearCommand *command = push<ClearCommand>(CommandType::Clear);
+    command->clear_color = clear_color;
+    command->clear_depth = clear_depth;
+}
+
+void CommandList::draw(std::span<const Patch> patches, const DrawPatchesConfig &cfg, u32 uniform_slot) {
+    DrawCommand *command = push<DrawCommand>(CommandType::Draw);
+    command->patches = patches;
+    command->cfg = cfg;
+    command->uniform_slot = uniform_slot;
+}
+
+void CommandList::barrier() {
+    push<BarrierCommand>(CommandType::Barrier);
+}
+
+const CommandHeader *CommandList::first() const {
+    return _first;
+}
+u32 CommandList::command_count() const {
+    return _command_count;
+}
+
+static bool is_same_draw_state(const DrawPatchesConfig &a, const DrawPatchesConfig &b) {
+    return a.front_winding == b.front_winding &&
+           a.enable_back_cull == b.enable_back_cull &&
+           a.depth_test == b.depth_test &&
+           a.enable_z_prepass == b.enable_z_prepass &&
+           a.vertex_shader_fn == b.vertex_shader_fn &&
+           a.patch_shader_fn == b.patch_shader_fn &&
+           a.uniforms == b.uniforms;
+}
+
+static bool is_sharing_target(const RenderTarget &a_color, const RenderTarget &a_depth, const RenderTarget &b_color, const RenderTarget &b_depth) {
+    auto same = [](const RenderTarget &a, const RenderTarget &b) {
+        return a.valid() && b.valid() && a.data == b.data;
+    };
+
+    return same(a_color, b_color) || same(a_color, b_depth) || same(a_depth, b_color) || same(a_depth, b_depth);
+}
+
+void CommandExecutor::build_passes(const CommandList &list, std::span<const void *const> uniform_slots) {
+    _ops.clear();
+    _passes.clear();
+
+    u32 group{};
+    for (const CommandHeader *header = list.first(); header != nullptr; header = header->next) {
+        switch (header->type) {
+            case CommandType::SetTargets: {
+                const auto *command = reinterpret_cast<const SetTargetsCommand *>(header);
+
+                _passes.push_back(Pass{
+                    .color_target = command->color_target,
+                    .depth_target = command->depth_target,
+                    .group = group,
+                    .first_op = _ops.size()
+                });
+                break;
+            }
+            case CommandType::Barrier: {
+                ++group;
+                break;
+            }
+            case CommandType::Clear: {
+                const auto *command = reinterpret_cast<const ClearCommand *>(header);
+                assert(!_passes.empty() && "Set the targets before clearing!");
+
+                _ops.push_back(Op{
+                    .type = CommandType::Clear,
+                    .clear_color = command->clear_color,
+                    .clear_depth = command->clear_depth
+                });
+                ++_passes.back().op_count;
+                break;
+            }
+            case CommandType::Draw: {
+                const auto *command = reinterpret_cast<const DrawCommand *>(header);
+                assert(!_passes.empty() && "Set the targets before drawing!");
+
+                DrawPatchesConfig cfg = command->cfg;
+                cfg.color_buffer = nullptr;
+                cfg.depth_buffer = nullptr;
+
+                if (command->uniform_slot != CommandList::NO_UNIFORM_SLOT) {
+                    assert(command->uniform_slot < uniform_slots.size());
+                    cfg.uniforms = uniform_slots[command->uniform_slot];
+                }
+
+                Pass &pass = _passes.back();
+
+                // Same state over the patches right after the previous draw's, one draw covers both. Not for Z-prepass
+                // draws: of patches at the same depth a single draw keeps the first, two separate ones the later.
+                if (pass.op_count > 0u && !cfg.enable_z_prepass) {
+                    Op &last = _ops.back();
+
+                    if (last.type == CommandType::Draw && is_same_draw_state(last.cfg, cfg) && last.patches.data() + last.patches.size() == command->patches.data()) {
+                        last.patches = std::span<const Patch>(last.patches.data(), last.patches.size() + command->patches.size());
+                        break;
+                    }
+                }
+
+                _ops.push_back(Op{
+                    .type = CommandType::Draw,
+                    .patches = command->patches,
+                    .cfg = cfg
+                });
+                ++pass.op_count;
+                break;
+            }
+        }
+    }
+
+    // Passes of a group sharing a target form a chain that runs in order, different chains run concurrently.
+    // Every pass points to the first pass of its chain.
+    for (usize i{}; i < _passes.size(); ++i) {
+        Pass &pass = _passes[i];
+        pass.chain = static_cast<u32>(i);
+
+        for (usize j{}; j < i; ++j) {
+            const Pass &other = _passes[j];
+
+            if (other.group != pass.group || !is_sharing_target(pass.color_target, pass.depth_target, other.color_target, other.depth_target)) {
+                continue;
+            }
+
+            // Joins both chains, the earlier one wins
+            u32 from = std::max(pass.chain, other.chain);
+            u32 to = std::min(pass.chain, other.chain);
+            for (usize k{}; k <= i; ++k) {
+                if (_passes[k].chain == from) {
+                    _passes[k].chain = to;
+                }
+            }
+        }
+    }
+}
+
+void CommandExecutor::run_pass(const Pass &pass) const {
+    usize op = pass.first_op;
+    usize end = pass.first_op + pass.op_count;
+
+    while (op < end) {
+        if (_ops[op].type == CommandType::Clear) {
+            if (pass.color_target.valid()) {
+                pass.color_target.fill(_ops[op].clear_color);
+            }
+            if (pass.depth_target.valid()) {
+                pass.depth_target.fill(_ops[op].clear_depth);
+            }
+
+            ++op;
+            continue;
+        }
+
+        usize draws_end = op;
+        while (draws_end < end && _ops[draws_end].type == CommandType::Draw) {
+            ++draws_end;
+        }
+
+        bool has_prepass = pass.color_target.valid() && pass.depth_target.valid();
+
+        // Regular draws and the depth halves of Z-prepass draws first, in recorded order
+        for (usize i = op; i < draws_end; ++i) {
+            DrawPatchesConfig cfg = _ops[i].cfg;
+
+            if (has_prepass && cfg.enable_z_prepass) {
+                cfg.enable_z_prepass = false;
+                cfg.depth_test = DepthTest::Less;
+
+                raster::draw_patches(_ops[i].patches, cfg, RenderTarget{}, pass.depth_target);
+            } else {
+                raster::draw_patches(_ops[i].patches, cfg, pass.color_target, pass.depth_target);
+            }
+        }
+
+        // Then the color halves, once the depth of everything in between clears is known
+        if (has_prepass) {
+            for (usize i = op; i < draws_end; ++i) {
+                DrawPatchesConfig cfg = _ops[i].cfg;
+
+                if (cfg.enable_z_prepass) {
+                    cfg.enable_z_prepass = false;
+                    cfg.depth_test = DepthTest::Equal;
+
+                    raster::draw_patches(_ops[i].patches, cfg, pass.color_target, pass.depth_target);
+                }
+            }
+        }
+
+        op = draws_end;
+    }
+}
+
+void CommandExecutor::run_chain(u32 group, u32 chain) const {
+    for (const Pass &pass : _passes) {
+        if (pass.group == group && pass.chain == chain) {
+            run_pass(pass);
+        }
+    }
+}
+
+void CommandExecutor::execute(const CommandList &list, std::span<const void *const> uniform_slots) {
+    build_passes(list, uniform_slots);
+
+    if (_passes.empty()) {
+        return;
+    }
+
+    u32 group_count = _passes.back().group + 1u;
+    for (u32 group{}; group < group_count; ++group) {
+        _chain_order.clear();
+        for (usize i{}; i < _passes.size(); ++i) {
+            if (_passes[i].group == group && _passes[i].chain == i) {
+                _chain_order.push_back(static_cast<u32>(i));
+            }
+        }
+
+        if (_chain_order.empty()) {
+            continue;
+        }
+
+        // Depth-only chains (shadow maps and such) start first
+        std::stable_partition(_chain_order.begin(), _chain_order.end(), [&](u32 chain) {
+            for (const Pass &pass : _passes) {
+                if (pass.group == group && pass.chain == chain && pass.color_target.valid()) {
+                    return false;
+                }
+            }
+
+            return true;
+        });
+
+        get_worker_pool().run(static_cast<u32>(_chain_order.size()), [&](u32 i) {
+            run_chain(group, _chain_order[i]);
+        });
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef SIMD_EXPERIMENT_COMMAND_LIST_HPP
+#define SIMD_EXPERIMENT_COMMAND_LIST_HPP
+
+#include <span>
+#include <vector>
+
+#include "raster.hpp"
+#include "arena.hpp"
+
+enum struct CommandType : u32 {
+    SetTargets = 1u,
+    Clear = 2u,
+    Draw = 3u,
+    Barrier = 4u,
+};
+
+// Commands are stored in the list's arena, linked in recording order
+struct CommandHeader {
+    CommandType type{};
+    const CommandHeader *next{};
+};
+
+struct SetTargetsCommand {
+    CommandHeader header{};
+    RenderTarget color_target{};
+    RenderTarget depth_target{};
+};
+
+struct ClearCommand {
+    CommandHeader header{};
+    u32 clear_color{};
+    u32 clear_depth{};
+};
+
+struct DrawCommand {
+    CommandHeader header{};
+    std::span<const Patch> patches{};
+
+    // The buffers of the config are ignored, the draw goes to the current targets
+    DrawPatchesConfig cfg{};
+
+    // Index into the uniform blocks given to the executor, or NO_UNIFORM_SLOT to use cfg.uniforms as recorded
+    u32 uniform_slot{};
+};
+
+struct BarrierCommand {
+    CommandHeader header{};
+};
+
+// Records clears, draws and target switches to be executed later by a CommandExecutor, any number of times. Draws can
+// refer to their uniforms by slot, so the same list can be replayed with different uniform blocks.
+class CommandList {
+public:
+    static constexpr u32 NO_UNIFORM_SLOT = UINT32_MAX;
+
+    explicit CommandList(usize arena_block_size = Arena::DEFAULT_BLOCK_SIZE);
+
+    // Drops all recorded commands, the memory is kept for the next recording
+    void reset();
+
+    // Starts a new pass. Every pass needs at least one valid target.
+    void set_targets(const RenderTarget &color_target, const RenderTarget &depth_target);
+
+    // Clears the valid targets of the current pass
+    void clear(u32 clear_color, u32 clear_depth);
+
+    // The patches have to stay valid as long as the list is executed
+    void draw(std::span<const Patch> patches, const DrawPatchesConfig &cfg, u32 uniform_slot = NO_UNIFORM_SLOT);
+
+    // Passes recorded before the barrier finish before any pass after it starts. Passes between two barriers may run
+    // concurrently unless they share a target, so a pass sampling another pass' target has to be behind a barrier.
+    void barrier();
+
+    const CommandHeader *first() const;
+    u32 command_count() const;
+
+private:
+    template <typename T>
+    T *push(CommandType type);
+
+    Arena _arena;
+    CommandHeader *_first{};
+    CommandHeader *_last{};
+    u32 _command_count{};
+};
+
+// Schedules and runs command lists:
+// - consecutive draws with the same state over adjacent patch ranges are merged into one draw, except Z-prepass draws
+// - Z-prepass draws run their depth halves before any of their color halves, together with the other draws of the pass
+// - passes without a color target (e.g. shadow maps) are started first
+// - independent passes between barriers run concurrently on the worker pool
+// The scratch memory is kept between executions.
+class CommandExecutor {
+public:
+    void execute(const CommandList &list, std::span<const void *const> uniform_slots = {});
+
+private:
+    struct Op {
+        CommandType type{};
+        std::span<const Patch> patches{};
+        DrawPatchesConfig cfg{};
+        u32 clear_color{};
+        u32 clear_depth{};
+    };
+    struct Pass {
+        RenderTarget color_target{};
+        RenderTarget depth_target{};
+        u32 group{};
+        usize first_op{};
+        usize op_count{};
+        u32 chain{};
+    };
+
+    void build_passes(const CommandList &list, std::span<const void *const> uniform_slots);
+    void run_chain(u32 group, u32 chain) const;
+    void run_pass(const Pass &pass) const;
+
+    std::vector<Op> _ops{};
+    std::vector<Pass> _passes{};
+    std::vector<u32> _chain_order{};
+};
+
+template <typename T>
+T *CommandList::push(CommandType type) {
+    T *command = _arena.create<T>();
+    command->header.type = type;
+
+    if (_last != nullptr) {
+        _last->next = &command->header;
+    } else {
+        _first = &command->header;
+    }
+
+    _last = &command->header;
+    ++_command_count;
+
+    return command;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "cpu_features.hpp"
+
+static constexpr const char *SIMD_TIER_NAMES[SIMD_TIER_COUNT] = { "scalar", "sse", "avx2", "avx512" };
+
+static void cpuid(u32 leaf, u32 subleaf, u32 regs[4]) {
+#if defined(_MSC_VER)
+    i32 info[4]{};
+    __cpuidex(info, static_cast<i32>(leaf), static_cast<i32>(subleaf));
+    for (u32 i{}; i < 4u; ++i) {
+        regs[i] = static_cast<u32>(info[i]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// XCR0, which register states the OS saves on a context switch
+static u64 get_xcr0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    u32 lo{}, hi{};
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<u64>(hi) << 32u) | lo;
+#endif
+}
+
+static CpuFeatures query_cpu_features() {
+    CpuFeatures features{};
+
+    u32 regs[4]{};
+    cpuid(0u, 0u, regs);
+    const u32 max_leaf = regs[0];
+
+    if (max_leaf < 1u) {
+        return features;
+    }
+
+    cpuid(1u, 0u, regs);
+    features.sse41 = (regs[2] & (1u << 19u)) != 0u;
+    features.sse42 = (regs[2] & (1u << 20u)) != 0u;
+
+    const bool osxsave = (regs[2] & (1u << 27u)) != 0u;
+    const bool cpu_avx = (regs[2] & (1u << 28u)) != 0u;
+
+    // XMM and YMM state, for AVX-512 also the opmask and both halves of ZMM
+    const u64 xcr0 = osxsave ? get_xcr0() : 0u;
+    const bool os_avx = (xcr0 & 0b110u) == 0b110u;
+    const bool os_avx512 = (xcr0 & 0b11100110u) == 0b11100110u;
+
+    features.avx = cpu_avx && os_avx;
+
+    if (max_leaf >= 7u) {
+        cpuid(7u, 0u, regs);
+        features.avx2 = features.avx && (regs[1] & (1u << 5u)) != 0u;
+        features.avx512f = os_avx512 && (regs[1] & (1u << 16u)) != 0u;
+        features.avx512dq = os_avx512 && (regs[1] & (1u << 17u)) != 0u;
+        features.avx512bw = os_avx512 && (regs[1] & (1u << 30u)) != 0u;
+        features.avx512vl = os_avx512 && (regs[1] & (1u << 31u)) != 0u;
+    }
+
+    return features;
+}
+
+const CpuFeatures &get_cpu_features() {
+    static const CpuFeatures features = query_cpu_features();
+    return features;
+}
+
+bool is_simd_tier_supported(SimdTier tier) {
+    const CpuFeatures &features = get_cpu_features();
+
+    switch (tier) {
+        case SimdTier::Scalar:
+            return true;
+        case SimdTier::SSE:
+            return features.sse41;
+        case SimdTier::AVX2:
+            return features.avx2;
+        case SimdTier::AVX512:
+            return features.avx2 && features.avx512f && features.avx512bw && features.avx512dq && features.avx512vl;
+    }
+
+    return false;
+}
+
+SimdTier get_best_simd_tier() {
+    u32 max_tier = SIMD_TIER_COUNT - 1u;
+
+    if (const char *cap = std::getenv("SIMD_EXPERIMENT_MAX_SIMD_TIER")) {
+        for (u32 tier{}; tier < SIMD_TIER_COUNT; ++tier) {
+            if (std::strcmp(cap, SIMD_TIER_NAMES[tier]) == 0) {
+                max_tier = tier;
+            }
+        }
+    }
+
+    for (u32 tier = max_tier; tier > 0u; --tier) {
+        if (is_simd_tier_supported(static_cast<SimdTier>(tier))) {
+            return static_cast<SimdTier>(tier);
+        }
+    }
+
+    return SimdTier::Scalar;
+}
+
+const char *get_simd_tier_name(SimdTier tier) {
+    return SIMD_TIER_NAMES[static_cast<u32>(tier)];
+}
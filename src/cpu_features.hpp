@@ -0,0 +1,55 @@
+#ifndef SIMD_EXPERIMENT_CPU_FEATURES_HPP
+#define SIMD_EXPERIMENT_CPU_FEATURES_HPP
+
+#include "types.hpp"
+#include "math/math_config.hpp"
+
+// Instruction set levels the multi-versioned kernels are compiled for, in increasing order
+enum class SimdTier : u32 {
+    Scalar,
+    // SSE4.1
+    SSE,
+    // AVX2
+    AVX2,
+    // AVX-512 F, BW, DQ and VL
+    AVX512
+};
+
+static constexpr u32 SIMD_TIER_COUNT = 4u;
+
+// The tier everything outside of the kernels is compiled for
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX512)
+static constexpr SimdTier SIMD_COMPILED_TIER = SimdTier::AVX512;
+#elif defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+static constexpr SimdTier SIMD_COMPILED_TIER = SimdTier::AVX2;
+#elif defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_SSE)
+static constexpr SimdTier SIMD_COMPILED_TIER = SimdTier::SSE;
+#else
+static constexpr SimdTier SIMD_COMPILED_TIER = SimdTier::Scalar;
+#endif
+
+struct CpuFeatures {
+    bool sse41{};
+    bool sse42{};
+    // Only set if the OS saves the YMM registers as well
+    bool avx{};
+    bool avx2{};
+    // Only set if the OS saves the ZMM and mask registers as well
+    bool avx512f{};
+    bool avx512bw{};
+    bool avx512dq{};
+    bool avx512vl{};
+};
+
+// Queried with CPUID on the first call
+const CpuFeatures &get_cpu_features();
+
+bool is_simd_tier_supported(SimdTier tier);
+
+// Newest tier the CPU supports. The SIMD_EXPERIMENT_MAX_SIMD_TIER environment variable (scalar, sse, avx2 or avx512) caps it,
+// e.g. to run the older kernels on a new machine.
+SimdTier get_best_simd_tier();
+
+const char *get_simd_tier_name(SimdTier tier);
+
+#endif
@@ -0,0 +1,83 @@
+#include <cassert>
+
+#include "frame_scheduler.hpp"
+
+FrameScheduler::FrameScheduler(std::span<const FrameTargets> slots, RenderFn render_fn)
+    : _slots(slots.begin(), slots.end()), _render_fn(std::move(render_fn)) {
+    assert(!_slots.empty());
+
+    _worker = std::thread([this]() {
+        render_loop();
+    });
+}
+
+FrameScheduler::~FrameScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+
+    _worker.join();
+}
+
+void FrameScheduler::render_loop() {
+    for (u64 index{};; ++index) {
+        {
+            // The slot of this frame is free once the frame that used it before got released
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [&]() {
+                return _stop || index < _released_count + _slots.size();
+            });
+
+            if (_stop) {
+                return;
+            }
+        }
+
+        u32 slot = static_cast<u32>(index % _slots.size());
+
+        _render_fn(ScheduledFrame{
+            .index = index,
+            .slot = slot,
+            .color_target = _slots[slot].color_target,
+            .depth_target = _slots[slot].depth_target
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_rendered_count;
+        }
+        _condition.notify_all();
+    }
+}
+
+ScheduledFrame FrameScheduler::acquire_frame() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _condition.wait(lock, [&]() {
+        return _rendered_count > _released_count;
+    });
+
+    u64 index = _released_count;
+    u32 slot = static_cast<u32>(index % _slots.size());
+
+    return ScheduledFrame{
+        .index = index,
+        .slot = slot,
+        .color_target = _slots[slot].color_target,
+        .depth_target = _slots[slot].depth_target
+    };
+}
+
+void FrameScheduler::release_frame() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        assert(_released_count < _rendered_count);
+        ++_released_count;
+    }
+    _condition.notify_all();
+}
+
+u32 FrameScheduler::slot_count() const {
+    return static_cast<u32>(_slots.size());
+}
@@ -0,0 +1,60 @@
+#ifndef SIMD_EXPERIMENT_FRAME_SCHEDULER_HPP
+#define SIMD_EXPERIMENT_FRAME_SCHEDULER_HPP
+
+#include <span>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "raster.hpp"
+
+// One set of targets a frame can be rendered into
+struct FrameTargets {
+    RenderTarget color_target{};
+    RenderTarget depth_target{};
+};
+
+struct ScheduledFrame {
+    u64 index{};
+    u32 slot{};
+    RenderTarget color_target{};
+    RenderTarget depth_target{};
+};
+
+// Double/triple buffering. Frames are rendered on a worker thread into the next free slot, while the caller presents
+// (or copies out) the previous ones. The renderer runs ahead by at most slot count - 1 frames.
+class FrameScheduler {
+public:
+    using RenderFn = std::function<void(const ScheduledFrame &frame)>;
+
+    // Starts rendering right away. The targets have to outlive the scheduler.
+    FrameScheduler(std::span<const FrameTargets> slots, RenderFn render_fn);
+    ~FrameScheduler();
+
+    FrameScheduler(const FrameScheduler &) = delete;
+    FrameScheduler &operator=(const FrameScheduler &) = delete;
+
+    // Waits for the oldest frame that was not presented yet. Its targets are not rendered to until release_frame().
+    ScheduledFrame acquire_frame();
+    void release_frame();
+
+    u32 slot_count() const;
+
+private:
+    void render_loop();
+
+    std::vector<FrameTargets> _slots{};
+    RenderFn _render_fn{};
+
+    std::mutex _mutex{};
+    std::condition_variable _condition{};
+    u64 _rendered_count{};
+    u64 _released_count{};
+    bool _stop{};
+
+    std::thread _worker{};
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef SIMD_EXPERIMENT_HASH_HPP
+#define SIMD_EXPERIMENT_HASH_HPP
+
+#include <type_traits>
+
+#include "types.hpp"
+
+namespace raster {
+    static constexpr u64 HASH_SEED = 14695981039346656037ull;
+
+    // FNV-1a, only used to detect changes of the state that draws depend on
+    inline u64 hash_bytes(const void *data, usize size, u64 seed = HASH_SEED) {
+        const u8 *bytes = static_cast<const u8 *>(data);
+
+        u64 hash = seed;
+        for (usize i{}; i < size; ++i) {
+            hash ^= static_cast<u64>(bytes[i]);
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    template <typename... T>
+    inline u64 hash_values(const T &...values) {
+        static_assert((std::is_trivially_copyable_v<T> && ...), "Only trivially copyable values can be hashed!");
+
+        u64 hash = HASH_SEED;
+        ((hash = hash_bytes(&values, sizeof(T), hash)), ...);
+
+        return hash;
+    }
+}
+
+#endif
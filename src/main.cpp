@@ -1,84 +1,76 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <thread>
+#include <cassert>
 
 #include <MiniFB.h>
 
 #include "types.hpp"
 #include "math/math.hpp"
 #include "raster.hpp"
+#include "raster_pipeline.hpp"
+#include "retained_frame.hpp"
+#include "shadow_cascades.hpp"
+#include "mesh_lod.hpp"
+#include "hash.hpp"
+#include "frame_scheduler.hpp"
 #include "ply_importer.hpp"
+#include "raster_kernels.hpp"
+#include "arena.hpp"
+#include "allocation_counter.hpp"
 
 constexpr const char *WINDOW_TITLE = "SIMD Rasterizer";
 constexpr u32 FRAMEBUFFER_WIDTH = 960u;
 constexpr u32 FRAMEBUFFER_HEIGHT = 540u;
 
+// Double buffering, the next frame is rendered while the previous one is presented
+constexpr u32 FRAME_SLOT_COUNT = 2u;
+
+// Frames before debug builds start asserting that frames don't allocate, until then the buffers grow to fit and the
+// worker threads pick up their frame arenas
+constexpr u64 ALLOCATION_WARMUP_FRAMES = 60u;
+
 /// TODO:
 // +=, -=, *=, /= operators
 
-static mat4 _shader_view_proj_matrix{};
-static mat4 _shader_shadow_proj_view_matrix{};
-static vec4 _shader_object_position{};
-static vec3 _shader_sun_direction = vec3(1.0f).normalized();
-static vec3 _shader_sun_color{};
-
-static Framebuffer color_buffer{
-    .width = FRAMEBUFFER_WIDTH,
-    .height = FRAMEBUFFER_HEIGHT
-};
-static Framebuffer depth_buffer{
-    .width = FRAMEBUFFER_WIDTH,
-    .height = FRAMEBUFFER_HEIGHT
-};
-static Framebuffer shadow_map{
-    .width = 256u,
-    .height = 256u
+// Everything the shaders read, immutable while the frame is drawn
+struct SceneUniforms {
+    mat4 view_proj_matrix{};
+    vec3 sun_direction = vec3(1.0f).normalized();
+    vec3 sun_color{};
+    const ShadowCascades *shadow_cascades{};
 };
 
-static vec4 _vertex_shader(const vec4 &v_in) {
-    vec4 w_pos = v_in + _shader_object_position;
-    vec4 ndc = _shader_view_proj_matrix * w_pos;
+static Framebuffer color_buffers[FRAME_SLOT_COUNT]{};
+static Framebuffer depth_buffers[FRAME_SLOT_COUNT]{};
+static ShadowCascades shadow_cascades(ShadowCascadesConfig{
+    .cascade_count = 3u,
+    .resolution = 256u
+});
 
-    // Faster than creating a new vec4, it won't need ndc.w later anyway
-    return ndc / ndc.w;
-}
-static vec4 _shadow_vertex_shader(const vec4 &v_in) {
-    vec4 w_pos = v_in + _shader_object_position;
-    vec4 ndc = _shader_shadow_proj_view_matrix * w_pos;
+static vec4 _vertex_shader(const vec4 &v_in, const SceneUniforms &uniforms, const vec4 &object_position) {
+    vec4 w_pos = v_in + object_position;
+    vec4 ndc = uniforms.view_proj_matrix * w_pos;
 
     // Faster than creating a new vec4, it won't need ndc.w later anyway
     return ndc / ndc.w;
 }
-static vec4 _lit_patch_shader(const Patch &patch, const vec4 &avg_ndc) {
-    vec3 light = _shader_sun_color * std::max(patch.normal.dot(_shader_sun_direction), 0.0f);
+static vec4 _lit_patch_shader(const Patch &patch, const vec4 &avg_ndc, const SceneUniforms &uniforms) {
+    vec3 light = uniforms.sun_color * std::max(patch.normal.dot(uniforms.sun_direction), 0.0f);
 
     vec3 ambient = vec3(0.6f, 0.8f, 1.0f) * 0.25f;
 
     return vec4(patch.color * (light + ambient), 1.0f);
 }
-static vec4 _lit_shadow_patch_shader(const Patch &patch, const vec4 &avg_ndc) {
-    vec3 light = _shader_sun_color * std::max(patch.normal.dot(_shader_sun_direction), 0.0f);
-
-    vec4 avg_vpos = (patch.pos[0] + patch.pos[1] + patch.pos[2]) / 3.0f;
-
-    vec4 w_pos = avg_vpos + _shader_object_position;
-    vec4 shadow_ndc = _shader_shadow_proj_view_matrix * w_pos;
-    shadow_ndc = shadow_ndc / shadow_ndc.w;
-    u32 shadow32 = static_cast<u32>(std::max(std::min(shadow_ndc.z - 0.01f, 1.0f), 0.0f) * static_cast<f32>(UINT32_MAX));
-
-    u32 y = static_cast<u32>((shadow_ndc.y * 0.5f + 0.5f) * static_cast<f32>(shadow_map.height));
-    u32 x = static_cast<u32>((shadow_ndc.x * 0.5f + 0.5f) * static_cast<f32>(shadow_map.width));
-    if (shadow_map.data[y * shadow_map.width + x] < shadow32) {
-        light = vec3(0.0f);
-    }
+// `normal` is the patch's normal in world space, `shadow` its entry from ShadowCascades::patch_visibility()
+static vec4 _lit_shadow_patch_shader(const Patch &patch, const vec4 &avg_ndc, const SceneUniforms &uniforms, const vec3 &normal, f32 shadow) {
+    vec3 light = uniforms.sun_color * std::max(normal.dot(uniforms.sun_direction), 0.0f) * shadow;
 
     vec3 ambient = vec3(0.6f, 0.8f, 1.0f) * 0.25f;
 
     return vec4(patch.color * (light + ambient), 1.0f);
 }
-static vec4 _unlit_patch_shader(const Patch &patch, const vec4 &avg_ndc) {
-    return vec4(patch.color, 1.0f);
-}
 
 i32 main() {
     mfb_window *window = mfb_open_ex(WINDOW_TITLE, FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT, WF_RESIZABLE);
@@ -92,24 +84,58 @@ i32 main() {
     vec3 sun_direction = vec3(0.55f, 1.5f, -1.1f).normalized();
     vec3 sun_color = vec3(0.95f, 0.9f, 0.7f);
 
-    std::vector<Patch> main_mesh_patches{};
-    if (!ply_import("res/tree.ply", main_mesh_patches)) {
+    Mesh main_mesh{};
+    if (!ply_import("res/tree.ply", main_mesh)) {
         std::cout << "Failed to import a mesh!\n";
         return 1;
     }
 
-    std::vector<Patch> sun_mesh_patches{};
-    if (!ply_import("res/sun.ply", sun_mesh_patches)) {
+    Mesh sun_mesh{};
+    if (!ply_import("res/sun.ply", sun_mesh)) {
         std::cout << "Failed to import a mesh!\n";
         return 1;
     }
 
+    MeshLodChain main_mesh_lods{};
+    main_mesh_lods.build(main_mesh);
+
     std::cout << "Loaded everything\n";
+    std::cout << "Raster kernels: " << get_simd_tier_name(raster::get_raster_kernels().tier) << "\n";
+
+    u32 fill_thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    FrameTargets frame_slots[FRAME_SLOT_COUNT]{};
+    std::vector<RetainedFrame> main_frames{};
+
+    for (u32 slot{}; slot < FRAME_SLOT_COUNT; ++slot) {
+        color_buffers[slot].width = FRAMEBUFFER_WIDTH;
+        color_buffers[slot].height = FRAMEBUFFER_HEIGHT;
+        depth_buffers[slot].width = FRAMEBUFFER_WIDTH;
+        depth_buffers[slot].height = FRAMEBUFFER_HEIGHT;
+
+        frame_slots[slot] = FrameTargets{ color_buffers[slot].target(), depth_buffers[slot].target() };
+
+        // Only the tiles touched by draws that changed since the slot was last rendered get redrawn
+        main_frames.emplace_back(frame_slots[slot].color_target, frame_slots[slot].depth_target, clear_color, clear_depth, fill_thread_count);
+    }
+
+    // Per-patch shadow visibility of the main mesh, looked up in one batch whenever the lit draw changes
+    std::vector<f32> main_mesh_shadows{};
+    u64 main_mesh_shadows_hash{};
+
+    // Frames in a row the main mesh kept its level. Switching levels resizes the buffers, that frame may allocate.
+    u32 last_main_mesh_lod = ~0u;
+    u32 main_mesh_lod_frames{};
 
     auto last_frame_time = std::chrono::high_resolution_clock::now();
 
     f32 time = std::numbers::pi * 1.85f;
-    do {
+
+    // Runs on the scheduler's worker thread
+    auto render_frame = [&](const ScheduledFrame &frame) {
+        allocation_counter::Scope count_allocations{};
+        [[maybe_unused]] u64 allocation_count = allocation_counter::count();
+
         auto now = std::chrono::high_resolution_clock::now();
         f32 delta_time = std::chrono::duration<f32>(now - last_frame_time).count();
         last_frame_time = now;
@@ -118,60 +144,106 @@ i32 main() {
 
         // Main Update
         auto update_start = std::chrono::high_resolution_clock::now();
-            color_buffer.fill(clear_color);
-            shadow_map.fill(clear_depth);
-            depth_buffer.fill(clear_depth);
-
-            mat4 view = mat4::look_at(vec3(math::sin(time * 0.5f), math::sin(time) * 0.20f + 0.3f, math::cos(time * 0.5f)) * 5.5f, vec3(0.0f));
-            mat4 proj = mat4::perspective(math::deg_to_rad(60.0f), static_cast<f32>(color_buffer.width) / static_cast<f32>(color_buffer.height), 0.1f, 80.0f);
+            vec3 camera_position = vec3(math::sin(time * 0.5f), math::sin(time) * 0.20f + 0.3f, math::cos(time * 0.5f)) * 5.5f;
+            vec3 camera_target = vec3(0.0f);
+            f32 camera_fov = math::deg_to_rad(60.0f);
+            f32 camera_aspect = static_cast<f32>(frame.color_target.width) / static_cast<f32>(frame.color_target.height);
 
-            vec3 sun_pos = sun_direction * 40.0f;
-            mat4 shadow_view = mat4::look_at(sun_pos, sun_pos - sun_direction);
-            mat4 shadow_proj = mat4::orthogonal(10.0f, 10.0f, 0.1f, 80.0f);
+            mat4 view = mat4::look_at(camera_position, camera_target);
+            mat4 proj = mat4::perspective(camera_fov, camera_aspect, 0.1f, 80.0f);
         auto update_end = std::chrono::high_resolution_clock::now();
 
         // Main Render
         auto draw_start = std::chrono::high_resolution_clock::now();
-            _shader_shadow_proj_view_matrix = shadow_proj * shadow_view;
-            _shader_view_proj_matrix = proj * view;
-            _shader_sun_direction = sun_direction;
-            _shader_sun_color = sun_color;
+            const SceneUniforms uniforms{
+                .view_proj_matrix = proj * view,
+                .sun_direction = sun_direction,
+                .sun_color = sun_color,
+                .shadow_cascades = &shadow_cascades
+            };
+            const SceneUniforms *uniforms_ptr = &uniforms;
+
+            vec4 sun_mesh_position = vec4(sun_direction * 14.0f, 0.0f);
+
+            // Placed by its model matrix, moving, rotating or scaling it never touches the patches
+            mat4 main_mesh_model(1.0f);
+
+            // The shadows use the same level, so that the mesh doesn't shadow itself from a different shape
+            u32 main_mesh_lod = main_mesh_lods.select(uniforms.view_proj_matrix * main_mesh_model, frame.color_target.width, frame.color_target.height);
+            const Mesh &main_mesh_level = main_mesh_lods.level(main_mesh_lod);
+
+            main_mesh_lod_frames = main_mesh_lod == last_main_mesh_lod ? main_mesh_lod_frames + 1u : 0u;
+            last_main_mesh_lod = main_mesh_lod;
 
             // Shadows
-            _shader_object_position = vec4(0.0f);
-            raster::draw_patches(main_mesh_patches, DrawPatchesConfig {
-                .front_winding = WindingOrder::CW,
-                .vertex_shader_fn = _shadow_vertex_shader,
-                .depth_buffer = &shadow_map
-            });
+            shadow_cascades.begin(camera_position, camera_target, camera_fov, camera_aspect, 0.1f, sun_direction);
+
+            shadow_cascades.draw_model<PipelineState{ .front_winding = WindingOrder::CW, .enable_color = false }>(
+                main_mesh_level,
+                main_mesh_model,
+                raster::hash_values(main_mesh_lod)
+            );
+
+            shadow_cascades.end();
+
+            RetainedFrame &main_frame = main_frames[frame.slot];
+            main_frame.begin(raster::hash_values(uniforms.view_proj_matrix));
+
+            // The cascade selection also depends on the camera, not only on the cascades' contents
+            u64 shadows_hash = raster::hash_values(main_mesh_model, main_mesh_lod, main_mesh_level.version, camera_position, camera_target, shadow_cascades.content_version());
+            if (shadows_hash != main_mesh_shadows_hash) {
+                main_mesh_shadows.resize(main_mesh_level.patches.size());
+                shadow_cascades.patch_visibility(main_mesh_level, main_mesh_model, main_mesh_shadows);
+                main_mesh_shadows_hash = shadows_hash;
+            }
+
+            const Patch *main_patches = main_mesh_level.patches.data();
+            const f32 *main_shadows = main_mesh_shadows.data();
 
             // Geometry
-            _shader_object_position = vec4(0.0f);
-            raster::draw_patches(main_mesh_patches, DrawPatchesConfig {
-                .vertex_shader_fn = _vertex_shader,
-                .patch_shader_fn = _lit_shadow_patch_shader,
-                .color_buffer = &color_buffer,
-                .depth_buffer = &depth_buffer
-            });
+            main_frame.draw_model<PipelineState{}>(
+                main_mesh_level,
+                main_mesh_model,
+                uniforms.view_proj_matrix,
+                raster::hash_values(main_mesh_lod, uniforms.sun_direction, uniforms.sun_color, shadows_hash),
+                [=](const Patch &patch, const vec4 &avg_ndc, const mat4 &model, const vec3 &normal) {
+                    return _lit_shadow_patch_shader(patch, avg_ndc, *uniforms_ptr, normal, main_shadows[&patch - main_patches]);
+                }
+            );
 
             // Sun
-            _shader_object_position = vec4(sun_direction * 14.0f, 0.0f);
-            raster::draw_patches(sun_mesh_patches, DrawPatchesConfig {
-                .vertex_shader_fn = _vertex_shader,
-                .patch_shader_fn = _unlit_patch_shader,
-                .color_buffer = &color_buffer,
-                .depth_buffer = &depth_buffer
-            });
+            main_frame.draw_mesh<PipelineState{}>(
+                sun_mesh,
+                raster::hash_values(sun_mesh_position),
+                [=](const vec4 &v_in) { return _vertex_shader(v_in, *uniforms_ptr, sun_mesh_position); },
+                raster::prepacked_color_shader(sun_mesh)
+            );
+
+            main_frame.end();
         auto draw_end = std::chrono::high_resolution_clock::now();
 
         std::cout << "Frametime:\n";
         std::cout << "\tupdate: " << std::chrono::duration<f32>(update_end - update_start).count() * 1000.0f << "ms\n";
         std::cout << "\tdraw: " << std::chrono::duration<f32>(draw_end - draw_start).count() * 1000.0f << "ms\n\n";
 
-        if (mfb_update_ex(window, color_buffer.data, color_buffer.width, color_buffer.height) < 0) {
+        get_frame_arena().reset();
+
+        // Once every slot was drawn with the current level, everything fits and nothing may allocate anymore (debug only)
+        assert((frame.index < ALLOCATION_WARMUP_FRAMES || main_mesh_lod_frames < FRAME_SLOT_COUNT || allocation_counter::count() == allocation_count) && "Steady-state frame allocated!");
+    };
+
+    FrameScheduler scheduler(frame_slots, render_frame);
+
+    do {
+        ScheduledFrame frame = scheduler.acquire_frame();
+
+        i32 state = mfb_update_ex(window, frame.color_target.data, frame.color_target.width, frame.color_target.height);
+        scheduler.release_frame();
+
+        if (state < 0) {
             window = nullptr;
             std::cout << "Failed to update the window!\n";
             break;
         }
     } while (mfb_wait_sync(window));
-}
\ No newline at end of file
+}
@@ -298,10 +298,10 @@ namespace math {
 
         __m128 scalar = _mm_set_ps1(a);
 
-        __m128 dst = _mm_add_ps(src0, scalar);
-        __m128 dst = _mm_add_ps(src1, scalar);
-        __m128 dst = _mm_add_ps(src2, scalar);
-        __m128 dst = _mm_add_ps(src3, scalar);
+        __m128 dst0 = _mm_add_ps(src0, scalar);
+        __m128 dst1 = _mm_add_ps(src1, scalar);
+        __m128 dst2 = _mm_add_ps(src2, scalar);
+        __m128 dst3 = _mm_add_ps(src3, scalar);
 
         _mm_store_ps(m[0], dst0);
         _mm_store_ps(m[1], dst1);
@@ -333,10 +333,10 @@ namespace math {
 
         __m128 scalar = _mm_set_ps1(a);
 
-        __m128 dst = _mm_sub_ps(src0, scalar);
-        __m128 dst = _mm_sub_ps(src1, scalar);
-        __m128 dst = _mm_sub_ps(src2, scalar);
-        __m128 dst = _mm_sub_ps(src3, scalar);
+        __m128 dst0 = _mm_sub_ps(src0, scalar);
+        __m128 dst1 = _mm_sub_ps(src1, scalar);
+        __m128 dst2 = _mm_sub_ps(src2, scalar);
+        __m128 dst3 = _mm_sub_ps(src3, scalar);
 
         _mm_store_ps(m[0], dst0);
         _mm_store_ps(m[1], dst1);
@@ -368,10 +368,10 @@ namespace math {
 
         __m128 scalar = _mm_set_ps1(a);
 
-        __m128 dst = _mm_mul_ps(src0, scalar);
-        __m128 dst = _mm_mul_ps(src1, scalar);
-        __m128 dst = _mm_mul_ps(src2, scalar);
-        __m128 dst = _mm_mul_ps(src3, scalar);
+        __m128 dst0 = _mm_mul_ps(src0, scalar);
+        __m128 dst1 = _mm_mul_ps(src1, scalar);
+        __m128 dst2 = _mm_mul_ps(src2, scalar);
+        __m128 dst3 = _mm_mul_ps(src3, scalar);
 
         _mm_store_ps(m[0], dst0);
         _mm_store_ps(m[1], dst1);
@@ -402,10 +402,10 @@ namespace math {
 
         __m128 scalar = _mm_set_ps1(a);
 
-        __m128 dst = _mm_div_ps(src0, scalar);
-        __m128 dst = _mm_div_ps(src1, scalar);
-        __m128 dst = _mm_div_ps(src2, scalar);
-        __m128 dst = _mm_div_ps(src3, scalar);
+        __m128 dst0 = _mm_div_ps(src0, scalar);
+        __m128 dst1 = _mm_div_ps(src1, scalar);
+        __m128 dst2 = _mm_div_ps(src2, scalar);
+        __m128 dst3 = _mm_div_ps(src3, scalar);
 
         _mm_store_ps(m[0], dst0);
         _mm_store_ps(m[1], dst1);
@@ -511,7 +511,7 @@ namespace math {
             right.x, up.x, -forward.x, 0.0f,
             right.y, up.y, -forward.y, 0.0f,
             right.z, up.z, -forward.z, 0.0f,
-            right.dot(position), up.dot(position), forward.dot(position), 1.0f
+            -right.dot(position), -up.dot(position), forward.dot(position), 1.0f
         };
     }
 }
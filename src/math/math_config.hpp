@@ -1,9 +1,31 @@
 #ifndef SIMD_EXPERIMENT_MATH_CONFIG_HPP
 #define SIMD_EXPERIMENT_MATH_CONFIG_HPP
 
-#define MATH_ENABLE_SIMD
-#define MATH_SIMD_AVX
-//#define MATH_SIMD_SSE
+// Defining MATH_DISABLE_SIMD for the whole build (e.g. from CMake) turns the manual intrinsics off without editing this file
+#ifndef MATH_DISABLE_SIMD
+    #define MATH_ENABLE_SIMD
+#endif
+
+// MATH_SIMD_RUNTIME_DISPATCH (set by CMake) builds everything for SSE4.1 except for the raster kernels, which are built
+// for every tier and picked by CPUID at startup, see raster_kernels.hpp
+#if defined(MATH_SIMD_RUNTIME_DISPATCH) && defined(MATH_DISABLE_SIMD)
+    #undef MATH_SIMD_RUNTIME_DISPATCH
+#endif
+
+#ifdef MATH_SIMD_RUNTIME_DISPATCH
+    #undef MATH_SIMD_AVX512
+    #define MATH_SIMD_SSE
+#else
+    #define MATH_SIMD_AVX
+    //#define MATH_SIMD_AVX512
+    //#define MATH_SIMD_SSE
+#endif
+
+// AVX-512 (also settable from CMake) only changes the raster kernels, the math types keep using AVX
+#ifdef MATH_SIMD_AVX512
+    #define MATH_SIMD_AVX
+#endif
+
 #define MATH_EXTRACT_NAMESPACE_TYPES
 
 #ifdef MATH_SIMD_AVX
@@ -12,6 +34,7 @@
 
 #ifdef MATH_SIMD_SSE
     #undef MATH_SIMD_AVX
+    #undef MATH_SIMD_AVX512
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+#include <algorithm>
+#include <unordered_map>
+
+#include "mesh_lod.hpp"
+#include "meshlets.hpp"
+#include "hash.hpp"
+
+// 21 bits per axis of a cell's coordinates
+static constexpr u32 MAX_CELL_COORD = (1u << 21u) - 1u;
+
+struct Cluster {
+    vec3 position_sum{};
+    u32 count{};
+};
+
+// Patch of the simplified mesh, accumulated from every source patch that collapsed onto the same three clusters
+struct MergedPatch {
+    u32 clusters[3]{};
+    vec3 color_sum{};
+    vec3 normal_sum{};
+    f32 weight{};
+};
+
+struct ClusterTriangleHash {
+    usize operator()(const std::array<u32, 3> &clusters) const {
+        return static_cast<usize>(raster::hash_values(clusters));
+    }
+};
+
+static u64 get_cell_key(const vec4 &position, const vec3 &origin, f32 inv_cell_size) {
+    auto cell_coord = [&](f32 value, f32 min) {
+        f32 coord = std::floor((value - min) * inv_cell_size);
+        return static_cast<u64>(std::clamp(coord, 0.0f, static_cast<f32>(MAX_CELL_COORD)));
+    };
+
+    return cell_coord(position.x, origin.x) | (cell_coord(position.y, origin.y) << 21u) | (cell_coord(position.z, origin.z) << 42u);
+}
+
+static f32 get_patch_area(const vec3 &a, const vec3 &b, const vec3 &c) {
+    return (b - a).cross(c - a).magnitude() * 0.5f;
+}
+
+static void cluster_patches(const Mesh &source, f32 cell_size, Mesh &out) {
+    const vec3 origin = source.bounds.min;
+    const f32 inv_cell_size = 1.0f / cell_size;
+
+    std::vector<Cluster> clusters{};
+    std::unordered_map<u64, u32> cell_clusters{};
+    std::vector<u32> vertex_clusters(source.patches.size() * 3u);
+
+    for (usize i{}; i < source.patches.size(); ++i) {
+        for (u32 k{}; k < 3u; ++k) {
+            const vec4 &position = source.patches[i].pos[k];
+
+            auto [it, inserted] = cell_clusters.try_emplace(get_cell_key(position, origin, inv_cell_size), static_cast<u32>(clusters.size()));
+            if (inserted) {
+                clusters.push_back(Cluster{});
+            }
+
+            Cluster &cluster = clusters[it->second];
+            cluster.position_sum = cluster.position_sum + position.xyz();
+            ++cluster.count;
+
+            vertex_clusters[i * 3u + k] = it->second;
+        }
+    }
+
+    // The average stays inside the cell, so no vertex moves further than the cell's diagonal
+    std::vector<vec3> cluster_positions(clusters.size());
+    for (usize i{}; i < clusters.size(); ++i) {
+        cluster_positions[i] = clusters[i].position_sum / static_cast<f32>(clusters[i].count);
+    }
+
+    std::vector<MergedPatch> merged{};
+    std::unordered_map<std::array<u32, 3>, u32, ClusterTriangleHash> merged_indices{};
+
+    for (usize i{}; i < source.patches.size(); ++i) {
+        const Patch &patch = source.patches[i];
+
+        u32 c0 = vertex_clusters[i * 3u + 0u];
+        u32 c1 = vertex_clusters[i * 3u + 1u];
+        u32 c2 = vertex_clusters[i * 3u + 2u];
+
+        // Collapsed to a line or a point
+        if (c0 == c1 || c1 == c2 || c2 == c0) {
+            continue;
+        }
+
+        // Rotated so the smallest cluster comes first, the same triangle with the same winding always gets the same key
+        std::array<u32, 3> key{ c0, c1, c2 };
+        std::rotate(key.begin(), std::min_element(key.begin(), key.end()), key.end());
+
+        auto [it, inserted] = merged_indices.try_emplace(key, static_cast<u32>(merged.size()));
+        if (inserted) {
+            merged.push_back(MergedPatch{ .clusters = { key[0], key[1], key[2] } });
+        }
+
+        f32 weight = std::max(get_patch_area(patch.pos[0].xyz(), patch.pos[1].xyz(), patch.pos[2].xyz()), FLT_MIN);
+
+        MergedPatch &target = merged[it->second];
+        target.color_sum = target.color_sum + patch.color * weight;
+        target.normal_sum = target.normal_sum + patch.normal * weight;
+        target.weight += weight;
+    }
+
+    out.patches.clear();
+    out.patches.reserve(merged.size());
+
+    for (const MergedPatch &patch : merged) {
+        const vec3 &p0 = cluster_positions[patch.clusters[0]];
+        const vec3 &p1 = cluster_positions[patch.clusters[1]];
+        const vec3 &p2 = cluster_positions[patch.clusters[2]];
+
+        // Distinct clusters can still end up on a line
+        if (get_patch_area(p0, p1, p2) <= 0.0f) {
+            continue;
+        }
+
+        out.patches.push_back(Patch{
+            .pos = { vec4(p0, 1.0f), vec4(p1, 1.0f), vec4(p2, 1.0f) },
+            .normal = patch.normal_sum.magnitude() > 0.0f ? patch.normal_sum.normalized() : (p1 - p0).cross(p2 - p0).normalized(),
+            .color = patch.color_sum / patch.weight
+        });
+    }
+
+    out.mark_modified();
+}
+
+MeshLodChain::MeshLodChain(const MeshLodConfig &config) : _config(config) {
+    assert(config.max_levels >= 1u && config.max_levels <= MESH_LOD_MAX_LEVELS);
+    assert(config.base_resolution >= 1u);
+}
+
+void MeshLodChain::build(const Mesh &source) {
+    _levels.clear();
+    _errors.clear();
+
+    _levels.push_back(source);
+    _errors.push_back(0.0f);
+
+    vec3 size = source.bounds.max - source.bounds.min;
+    _sphere_center = (source.bounds.min + source.bounds.max) * 0.5f;
+    _sphere_radius = size.magnitude() * 0.5f;
+
+    f32 extent = std::max({ size.x, size.y, size.z });
+    if (source.patches.empty() || extent <= 0.0f) {
+        return;
+    }
+
+    for (u32 resolution = _config.base_resolution; resolution >= 1u && _levels.size() < _config.max_levels; resolution /= 2u) {
+        f32 cell_size = extent / static_cast<f32>(resolution);
+
+        Mesh level{};
+        cluster_patches(source, cell_size, level);
+
+        if (level.patches.empty()) {
+            break;
+        }
+
+        // Not worth a level of its own, a coarser grid may still be
+        if (static_cast<f32>(level.patches.size()) > static_cast<f32>(_levels.back().patches.size()) * _config.max_kept_fraction) {
+            continue;
+        }
+
+        build_meshlets(level);
+
+        _levels.push_back(std::move(level));
+        _errors.push_back(cell_size * std::sqrt(3.0f));
+    }
+}
+
+u32 MeshLodChain::select(const mat4 &model_view_proj, u32 viewport_width, u32 viewport_height) const {
+    assert(!_levels.empty() && "Build the chain before selecting from it!");
+
+    const auto &m = model_view_proj.m;
+
+    // Rows of the matrix, their lengths are how much one object space unit changes x, y and w in clip space
+    vec3 row_x(m[0][0], m[1][0], m[2][0]);
+    vec3 row_y(m[0][1], m[1][1], m[2][1]);
+    vec3 row_w(m[0][3], m[1][3], m[2][3]);
+
+    vec4 center = model_view_proj * vec4(_sphere_center, 1.0f);
+    f32 nearest_w = center.w - _sphere_radius * row_w.magnitude();
+
+    // The camera is inside the bounding sphere
+    if (nearest_w <= 0.0f) {
+        return 0u;
+    }
+
+    f32 pixels_per_unit = std::max(row_x.magnitude() * static_cast<f32>(viewport_width), row_y.magnitude() * static_cast<f32>(viewport_height)) * 0.5f / nearest_w;
+
+    for (u32 level = level_count() - 1u; level > 0u; --level) {
+        if (_errors[level] * pixels_per_unit <= _config.max_error_px) {
+            return level;
+        }
+    }
+
+    return 0u;
+}
+
+const Mesh &MeshLodChain::level(u32 level) const {
+    assert(level < _levels.size());
+    return _levels[level];
+}
+
+u32 MeshLodChain::level_count() const {
+    return static_cast<u32>(_levels.size());
+}
+
+f32 MeshLodChain::level_error(u32 level) const {
+    assert(level < _errors.size());
+    return _errors[level];
+}
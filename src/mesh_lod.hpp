@@ -0,0 +1,95 @@
+#ifndef SIMD_EXPERIMENT_MESH_LOD_HPP
+#define SIMD_EXPERIMENT_MESH_LOD_HPP
+
+#include <span>
+#include <array>
+#include <vector>
+
+#include "raster.hpp"
+#include "raster_pipeline.hpp"
+#include "arena.hpp"
+
+static constexpr u32 MESH_LOD_MAX_LEVELS = 8u;
+
+struct MeshLodConfig {
+    // Including the full detail level
+    u32 max_levels = 6u;
+
+    // Clustering cells along the longest side of the bounds for the first simplified level, halved for every next one
+    u32 base_resolution = 64u;
+
+    // No more levels are built once a level keeps more than this fraction of the previous level's patches
+    f32 max_kept_fraction = 0.9f;
+
+    // A level is used as long as its error stays below this many pixels on screen
+    f32 max_error_px = 1.0f;
+};
+
+// Chain of simplified copies of a mesh, built with vertex clustering: the vertices are snapped to the average position
+// of their grid cell, patches collapsing to a line are dropped and patches ending up on the same three clusters are
+// merged, averaging their colors and normals weighted by area. The winding of the kept patches doesn't change.
+class MeshLodChain {
+public:
+    explicit MeshLodChain(const MeshLodConfig &config = {});
+
+    // Level 0 is a copy of the source. Has to be called again after the source was modified.
+    void build(const Mesh &source);
+
+    // Coarsest level whose error projects to at most max_error_px. The bounding sphere of the mesh gives the pixels
+    // per object space unit at its point closest to the camera, so the selection is conservative.
+    u32 select(const mat4 &model_view_proj, u32 viewport_width, u32 viewport_height) const;
+
+    const Mesh &level(u32 level) const;
+    u32 level_count() const;
+
+    // How far a vertex of the level may be from its source position, in object space units
+    f32 level_error(u32 level) const;
+
+private:
+    MeshLodConfig _config{};
+
+    std::vector<Mesh> _levels{};
+    std::vector<f32> _errors{};
+
+    vec3 _sphere_center{};
+    f32 _sphere_radius{};
+};
+
+namespace raster {
+    // Instanced draw picking a level per instance, instances sharing a level are drawn together with draw_instanced()
+    template <PipelineState State, typename PatchShader>
+    void draw_instanced_lod(const MeshLodChain &chain, std::span<const mat4> instance_transforms, const mat4 &view_proj, const PatchShader &patch_shader, const RenderTarget &color_buffer, const RenderTarget &depth_buffer) {
+        u32 width = State.enable_color ? color_buffer.width : depth_buffer.width;
+        u32 height = State.enable_color ? color_buffer.height : depth_buffer.height;
+
+        // The instances sorted by level, from the calling thread's frame arena and released on return
+        Arena &scratch = get_frame_arena().local();
+        ArenaScope scratch_scope(scratch);
+
+        std::span<u32> instance_levels = scratch.allocate_array<u32>(instance_transforms.size());
+        std::array<usize, MESH_LOD_MAX_LEVELS + 1u> level_starts{};
+        for (usize i{}; i < instance_transforms.size(); ++i) {
+            instance_levels[i] = chain.select(view_proj * instance_transforms[i], width, height);
+            ++level_starts[instance_levels[i] + 1u];
+        }
+        for (u32 level{}; level < MESH_LOD_MAX_LEVELS; ++level) {
+            level_starts[level + 1u] += level_starts[level];
+        }
+
+        // Keeps the order of the instances within a level
+        std::span<mat4> level_instances = scratch.allocate_array<mat4>(instance_transforms.size());
+        std::array<usize, MESH_LOD_MAX_LEVELS + 1u> level_ends = level_starts;
+        for (usize i{}; i < instance_transforms.size(); ++i) {
+            level_instances[level_ends[instance_levels[i]]++] = instance_transforms[i];
+        }
+
+        for (u32 level{}; level < chain.level_count(); ++level) {
+            if (level_starts[level + 1u] > level_starts[level]) {
+                std::span<const mat4> instances = level_instances.subspan(level_starts[level], level_starts[level + 1u] - level_starts[level]);
+                draw_instanced<State>(chain.level(level), instances, view_proj, patch_shader, color_buffer, depth_buffer);
+            }
+        }
+    }
+}
+
+#endif
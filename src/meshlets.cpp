@@ -0,0 +1,177 @@
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+#include "meshlets.hpp"
+#include "patch_bvh.hpp"
+#include "patch_order.hpp"
+
+// One group per signed axis, plus one for patches without area
+static constexpr u32 NORMAL_GROUP_COUNT = 7u;
+
+struct PatchRange {
+    u32 first{};
+    u32 count{};
+};
+
+static vec3 get_face_normal(const Patch &patch) {
+    return (patch.pos[1] - patch.pos[0]).xyz().cross((patch.pos[2] - patch.pos[0]).xyz());
+}
+
+static u32 get_normal_group(const vec3 &normal) {
+    f32 abs[3]{ std::abs(normal.x), std::abs(normal.y), std::abs(normal.z) };
+    if (abs[0] + abs[1] + abs[2] <= 0.0f) {
+        return NORMAL_GROUP_COUNT - 1u;
+    }
+
+    f32 components[3]{ normal.x, normal.y, normal.z };
+    u32 axis = static_cast<u32>(std::max_element(abs, abs + 3) - abs);
+
+    return axis * 2u + (components[axis] < 0.0f ? 1u : 0u);
+}
+
+// The patches of a subtree are next to each other in the BVH's patch indices
+static PatchRange get_subtree_range(std::span<const BvhNode> nodes, u32 node_index) {
+    u32 first_leaf = node_index;
+    while (nodes[first_leaf].count == 0u) {
+        first_leaf = first_leaf + 1u;
+    }
+
+    u32 last_leaf = node_index;
+    while (nodes[last_leaf].count == 0u) {
+        last_leaf = nodes[last_leaf].first;
+    }
+
+    u32 first = nodes[first_leaf].first;
+    return PatchRange{ first, nodes[last_leaf].first + nodes[last_leaf].count - first };
+}
+
+static void collect_ranges(std::span<const BvhNode> nodes, u32 node_index, std::vector<PatchRange> &ranges) {
+    PatchRange range = get_subtree_range(nodes, node_index);
+
+    if (range.count <= RASTER_MESHLET_MAX_PATCHES) {
+        // Neighbouring subtrees are close in space as well, small ones are merged
+        if (!ranges.empty() && ranges.back().count + range.count <= RASTER_MESHLET_MAX_PATCHES) {
+            ranges.back().count += range.count;
+        } else {
+            ranges.push_back(range);
+        }
+        return;
+    }
+
+    collect_ranges(nodes, node_index + 1u, ranges);
+    collect_ranges(nodes, nodes[node_index].first, ranges);
+}
+
+static Meshlet make_meshlet(std::span<const Patch> patches, u32 first) {
+    Meshlet meshlet{
+        .first = first,
+        .count = static_cast<u32>(patches.size())
+    };
+
+    vec4 min = patches[0].pos[0];
+    vec4 max = patches[0].pos[0];
+    vec3 normal_sum{};
+    for (const Patch &patch : patches) {
+        for (const vec4 &pos : patch.pos) {
+            min = min.min(pos);
+            max = max.max(pos);
+        }
+
+        vec3 normal = get_face_normal(patch);
+        if (normal.magnitude() > 0.0f) {
+            normal_sum = normal_sum + normal.normalized();
+        }
+    }
+
+    meshlet.center = ((min + max) * 0.5f).xyz();
+    for (const Patch &patch : patches) {
+        for (const vec4 &pos : patch.pos) {
+            meshlet.radius = std::max(meshlet.radius, (pos.xyz() - meshlet.center).magnitude());
+        }
+    }
+
+    if (normal_sum.magnitude() <= 0.0f) {
+        return meshlet;
+    }
+
+    // The cone's half angle is the largest angle between the axis and a normal. A patch without area has no
+    // winding to cull by, a meshlet containing one gets no cone.
+    meshlet.cone_axis = normal_sum.normalized();
+    meshlet.cone_cos = 1.0f;
+    for (const Patch &patch : patches) {
+        vec3 normal = get_face_normal(patch);
+        if (normal.magnitude() <= 0.0f) {
+            meshlet.cone_cos = 0.0f;
+            break;
+        }
+
+        meshlet.cone_cos = std::min(meshlet.cone_cos, meshlet.cone_axis.dot(normal.normalized()));
+    }
+
+    if (meshlet.cone_cos > 0.0f) {
+        meshlet.cone_sin = std::sqrt(std::max(1.0f - meshlet.cone_cos * meshlet.cone_cos, 0.0f));
+    }
+
+    return meshlet;
+}
+
+void build_meshlets(Mesh &mesh, PatchOrder order) {
+    std::vector<Patch> groups[NORMAL_GROUP_COUNT]{};
+    for (const Patch &patch : mesh.patches) {
+        groups[get_normal_group(get_face_normal(patch))].push_back(patch);
+    }
+
+    std::vector<Patch> grouped{};
+    std::vector<Meshlet> meshlets{};
+    grouped.reserve(mesh.patches.size());
+
+    PatchBvh bvh{};
+    std::vector<PatchRange> ranges{};
+    for (const std::vector<Patch> &group : groups) {
+        if (group.empty()) {
+            continue;
+        }
+
+        bvh.build(group);
+
+        ranges.clear();
+        collect_ranges(bvh.nodes(), 0u, ranges);
+
+        std::span<const u32> indices = bvh.patch_indices();
+        for (const PatchRange &range : ranges) {
+            u32 first = static_cast<u32>(grouped.size());
+            for (u32 i = range.first; i < range.first + range.count; ++i) {
+                grouped.push_back(group[indices[i]]);
+            }
+
+            meshlets.push_back(make_meshlet(std::span<const Patch>(grouped).subspan(first, range.count), first));
+        }
+    }
+
+    // The groups are spread over the whole mesh, ordering the meshlets along the curve keeps consecutive ones close
+    std::vector<std::pair<u32, u32>> keys(meshlets.size());
+    for (usize i{}; i < meshlets.size(); ++i) {
+        keys[i] = { get_curve_code(meshlets[i].center, mesh.bounds, order), static_cast<u32>(i) };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<Patch> ordered{};
+    std::vector<Meshlet> ordered_meshlets{};
+    ordered.reserve(grouped.size());
+    ordered_meshlets.reserve(meshlets.size());
+
+    for (const auto &[code, index] : keys) {
+        Meshlet meshlet = meshlets[index];
+
+        u32 first = static_cast<u32>(ordered.size());
+        ordered.insert(ordered.end(), grouped.begin() + meshlet.first, grouped.begin() + meshlet.first + meshlet.count);
+
+        meshlet.first = first;
+        ordered_meshlets.push_back(meshlet);
+    }
+
+    mesh.patches = std::move(ordered);
+    mesh.mark_modified();
+    mesh.meshlets = std::move(ordered_meshlets);
+}
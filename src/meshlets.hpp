@@ -0,0 +1,13 @@
+#ifndef SIMD_EXPERIMENT_MESHLETS_HPP
+#define SIMD_EXPERIMENT_MESHLETS_HPP
+
+#include "raster.hpp"
+#include "patch_order.hpp"
+
+// Reorders the patches into meshlets of up to RASTER_MESHLET_MAX_PATCHES patches. Patches are first grouped by the
+// dominant axis of their normal, which keeps the normal cones narrow, then split along a BVH so that every meshlet is
+// spatially compact. The meshlets are ordered along the curve by their centers, PatchOrder::Source keeps them grouped.
+// Bumps the mesh's version.
+void build_meshlets(Mesh &mesh, PatchOrder order = PatchOrder::Hilbert);
+
+#endif
@@ -0,0 +1,514 @@
+#include <bit>
+#include <cmath>
+#include <cfloat>
+#include <thread>
+#include <cassert>
+#include <algorithm>
+
+#include "patch_bvh.hpp"
+
+static constexpr u32 BVH_BIN_COUNT = 16u;
+static constexpr u32 BVH_MAX_LEAF_SIZE = 4u;
+
+// Deeper down the SAH is replaced by median splits, which keeps the traversal stacks bounded
+static constexpr u32 BVH_MAX_SAH_DEPTH = 48u;
+static constexpr u32 BVH_STACK_SIZE = 128u;
+
+// Median splits reach the leaves of any u32 patch count within 32 more levels. The traversals pop a node and push its
+// two children, so they never hold more than one entry per level plus one.
+static_assert(BVH_STACK_SIZE >= BVH_MAX_SAH_DEPTH + 32u + 1u, "The traversal stacks do not fit the deepest possible BVH!");
+
+// Smaller subtrees are not worth a thread
+static constexpr u32 BVH_PARALLEL_MIN_PATCHES = 4096u;
+
+// The 4th component is padding, so that the bounds can be grown with SSE
+struct Aabb {
+    alignas(16) f32 min[4]{ FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+    alignas(16) f32 max[4]{ -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    inline void grow(const Aabb &other) {
+#if defined(MATH_ENABLE_SIMD) && (defined(MATH_SIMD_AVX) || defined(MATH_SIMD_SSE))
+        _mm_store_ps(min, _mm_min_ps(_mm_load_ps(min), _mm_load_ps(other.min)));
+        _mm_store_ps(max, _mm_max_ps(_mm_load_ps(max), _mm_load_ps(other.max)));
+#else
+        for (u32 axis{}; axis < 3u; ++axis) {
+            min[axis] = std::min(min[axis], other.min[axis]);
+            max[axis] = std::max(max[axis], other.max[axis]);
+        }
+#endif
+    }
+    inline void grow(const f32 point[3]) {
+        for (u32 axis{}; axis < 3u; ++axis) {
+            min[axis] = std::min(min[axis], point[axis]);
+            max[axis] = std::max(max[axis], point[axis]);
+        }
+    }
+
+    // Half of the surface area is enough for comparing SAH costs
+    inline f32 half_area() const {
+        if (min[0] > max[0]) {
+            return 0.0f;
+        }
+
+        f32 x = max[0] - min[0];
+        f32 y = max[1] - min[1];
+        f32 z = max[2] - min[2];
+
+        return x * y + y * z + z * x;
+    }
+};
+
+// Partitioned in place during the build, so the primitives of a node are always next to each other in memory
+struct BvhPrimitive {
+    Aabb bounds{};
+    f32 centroid[3]{};
+    u32 patch_index{};
+};
+
+struct BvhBin {
+    Aabb bounds{};
+    u32 count{};
+};
+
+static void build_subtree(std::span<BvhPrimitive> primitives, u32 begin, u32 end, u32 depth, u32 parallel_depth, std::vector<BvhNode> &nodes) {
+    u32 node_index = static_cast<u32>(nodes.size());
+    nodes.push_back(BvhNode{});
+
+    Aabb bounds{};
+    Aabb centroid_bounds{};
+    for (u32 i = begin; i < end; ++i) {
+        bounds.grow(primitives[i].bounds);
+        centroid_bounds.grow(primitives[i].centroid);
+    }
+
+    u32 count = end - begin;
+
+    auto store_bounds = [&](BvhNode &node) {
+        std::copy(bounds.min, bounds.min + 3, node.min);
+        std::copy(bounds.max, bounds.max + 3, node.max);
+    };
+    auto make_leaf = [&]() {
+        BvhNode &node = nodes[node_index];
+        store_bounds(node);
+        node.first = begin;
+        node.count = count;
+    };
+
+    // Splitting small nodes any further costs more in traversal than it saves in patch tests
+    if (count <= BVH_MAX_LEAF_SIZE) {
+        make_leaf();
+        return;
+    }
+
+    // Binned SAH: primitives are sorted into bins by centroid, the split is the bin boundary with the lowest cost
+    f32 best_cost = FLT_MAX;
+    u32 best_axis = UINT32_MAX;
+    u32 best_split{};
+
+    if (depth < BVH_MAX_SAH_DEPTH) {
+        f32 scales[3]{};
+        for (u32 axis{}; axis < 3u; ++axis) {
+            f32 extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+            scales[axis] = extent > 0.0f ? static_cast<f32>(BVH_BIN_COUNT) / extent : 0.0f;
+        }
+
+        // All three axes in one pass over the primitives
+        BvhBin bins[3][BVH_BIN_COUNT]{};
+        for (u32 i = begin; i < end; ++i) {
+            const BvhPrimitive &primitive = primitives[i];
+
+            for (u32 axis{}; axis < 3u; ++axis) {
+                u32 bin = std::min(static_cast<u32>((primitive.centroid[axis] - centroid_bounds.min[axis]) * scales[axis]), BVH_BIN_COUNT - 1u);
+
+                bins[axis][bin].bounds.grow(primitive.bounds);
+                ++bins[axis][bin].count;
+            }
+        }
+
+        for (u32 axis{}; axis < 3u; ++axis) {
+            if (scales[axis] == 0.0f) {
+                continue;
+            }
+
+            // Costs of everything right of each boundary, then a sweep from the left
+            f32 right_costs[BVH_BIN_COUNT]{};
+            Aabb right_bounds{};
+            u32 right_count{};
+            for (u32 bin = BVH_BIN_COUNT - 1u; bin > 0u; --bin) {
+                right_bounds.grow(bins[axis][bin].bounds);
+                right_count += bins[axis][bin].count;
+                right_costs[bin] = right_bounds.half_area() * static_cast<f32>(right_count);
+            }
+
+            Aabb left_bounds{};
+            u32 left_count{};
+            for (u32 bin{}; bin + 1u < BVH_BIN_COUNT; ++bin) {
+                left_bounds.grow(bins[axis][bin].bounds);
+                left_count += bins[axis][bin].count;
+
+                f32 cost = left_bounds.half_area() * static_cast<f32>(left_count) + right_costs[bin + 1u];
+                if (left_count > 0u && left_count < count && cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = bin;
+                }
+            }
+        }
+    }
+
+    u32 mid;
+    if (best_axis == UINT32_MAX) {
+        // Too deep or all centroids in one spot: half of the patches on each side of the longest axis' median
+        u32 axis{};
+        for (u32 i = 1u; i < 3u; ++i) {
+            if (centroid_bounds.max[i] - centroid_bounds.min[i] > centroid_bounds.max[axis] - centroid_bounds.min[axis]) {
+                axis = i;
+            }
+        }
+
+        mid = begin + count / 2u;
+        std::nth_element(primitives.begin() + begin, primitives.begin() + mid, primitives.begin() + end, [&](const BvhPrimitive &a, const BvhPrimitive &b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+    } else {
+        f32 axis_min = centroid_bounds.min[best_axis];
+        f32 scale = static_cast<f32>(BVH_BIN_COUNT) / (centroid_bounds.max[best_axis] - axis_min);
+
+        auto split = std::partition(primitives.begin() + begin, primitives.begin() + end, [&](const BvhPrimitive &primitive) {
+            u32 bin = std::min(static_cast<u32>((primitive.centroid[best_axis] - axis_min) * scale), BVH_BIN_COUNT - 1u);
+            return bin <= best_split;
+        });
+        mid = static_cast<u32>(split - primitives.begin());
+    }
+
+    u32 right_index;
+    if (parallel_depth > 0u && count >= BVH_PARALLEL_MIN_PATCHES) {
+        // The right subtree goes into its own nodes, appended after the left subtree once both are done
+        std::vector<BvhNode> right_nodes{};
+        std::thread right_thread([&]() {
+            build_subtree(primitives, mid, end, depth + 1u, parallel_depth - 1u, right_nodes);
+        });
+
+        build_subtree(primitives, begin, mid, depth + 1u, parallel_depth - 1u, nodes);
+        right_thread.join();
+
+        right_index = static_cast<u32>(nodes.size());
+        for (BvhNode node : right_nodes) {
+            if (node.count == 0u) {
+                node.first += right_index;
+            }
+            nodes.push_back(node);
+        }
+    } else {
+        build_subtree(primitives, begin, mid, depth + 1u, parallel_depth, nodes);
+
+        right_index = static_cast<u32>(nodes.size());
+        build_subtree(primitives, mid, end, depth + 1u, parallel_depth, nodes);
+    }
+
+    BvhNode &node = nodes[node_index];
+    store_bounds(node);
+    node.first = right_index;
+    node.count = 0u;
+}
+
+void PatchBvh::build(std::span<const Patch> patches, u32 thread_count) {
+    _patches = patches;
+    _nodes.clear();
+    _patch_indices.resize(patches.size());
+
+    if (patches.empty()) {
+        return;
+    }
+
+    std::vector<BvhPrimitive> primitives(patches.size());
+    for (usize i{}; i < patches.size(); ++i) {
+        BvhPrimitive &primitive = primitives[i];
+
+        for (const vec4 &pos : patches[i].pos) {
+            f32 point[3]{ pos.x, pos.y, pos.z };
+            primitive.bounds.grow(point);
+        }
+        for (u32 axis{}; axis < 3u; ++axis) {
+            primitive.centroid[axis] = (primitive.bounds.min[axis] + primitive.bounds.max[axis]) * 0.5f;
+        }
+
+        primitive.patch_index = static_cast<u32>(i);
+    }
+
+    if (thread_count == 0u) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    // Every level splits the work in two
+    u32 parallel_depth = std::bit_width(thread_count - 1u);
+
+    // A binary tree with at least one patch per leaf
+    _nodes.reserve(patches.size() * 2u - 1u);
+    build_subtree(primitives, 0u, static_cast<u32>(patches.size()), 0u, parallel_depth, _nodes);
+
+    for (usize i{}; i < primitives.size(); ++i) {
+        _patch_indices[i] = primitives[i].patch_index;
+    }
+}
+
+void PatchBvh::frustum_cull(const mat4 &view_proj, std::vector<u32> &patch_indices) const {
+    patch_indices.clear();
+
+    if (_nodes.empty()) {
+        return;
+    }
+
+    const auto &m = view_proj.m;
+    vec4 rows[4]{};
+    for (u32 r{}; r < 4u; ++r) {
+        rows[r] = vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    }
+
+    // Points are inside where dot(plane, point) >= 0
+    const vec4 planes[6]{
+        rows[3] + rows[0],
+        rows[3] - rows[0],
+        rows[3] + rows[1],
+        rows[3] - rows[1],
+        rows[2],
+        rows[3] - rows[2]
+    };
+
+    struct Entry {
+        u32 node{};
+        // Planes the node is not yet known to be completely inside of
+        u32 plane_mask{};
+    };
+
+    Entry stack[BVH_STACK_SIZE]{};
+    u32 stack_size{};
+    stack[stack_size++] = Entry{ 0u, 0b111111u };
+
+    while (stack_size > 0u) {
+        Entry entry = stack[--stack_size];
+        const BvhNode &node = _nodes[entry.node];
+
+        bool outside = false;
+        for (u32 plane{}; plane < 6u; ++plane) {
+            if (!((entry.plane_mask >> plane) & 1u)) {
+                continue;
+            }
+
+            const vec4 &p = planes[plane];
+
+            // Box corners furthest along and against the plane's normal
+            f32 far_dist = p.w + p.x * (p.x > 0.0f ? node.max[0] : node.min[0]) + p.y * (p.y > 0.0f ? node.max[1] : node.min[1]) + p.z * (p.z > 0.0f ? node.max[2] : node.min[2]);
+            f32 near_dist = p.w + p.x * (p.x > 0.0f ? node.min[0] : node.max[0]) + p.y * (p.y > 0.0f ? node.min[1] : node.max[1]) + p.z * (p.z > 0.0f ? node.min[2] : node.max[2]);
+
+            if (far_dist < 0.0f) {
+                outside = true;
+                break;
+            }
+            if (near_dist >= 0.0f) {
+                entry.plane_mask &= ~(1u << plane);
+            }
+        }
+
+        if (outside) {
+            continue;
+        }
+
+        if (node.count > 0u) {
+            patch_indices.insert(patch_indices.end(), _patch_indices.begin() + node.first, _patch_indices.begin() + node.first + node.count);
+            continue;
+        }
+
+        assert(stack_size + 2u <= BVH_STACK_SIZE);
+        stack[stack_size++] = Entry{ node.first, entry.plane_mask };
+        stack[stack_size++] = Entry{ entry.node + 1u, entry.plane_mask };
+    }
+}
+
+// Entry distance of the ray into the node's box, FLT_MAX if it misses or enters beyond max_t
+static f32 intersect_node(const BvhNode &node, const f32 origin[3], const f32 inv_direction[3], f32 max_t) {
+    f32 t_min = 0.0f;
+    f32 t_max = max_t;
+
+    for (u32 axis{}; axis < 3u; ++axis) {
+        // Parallel to the slab, the ray is inside of it everywhere or nowhere. The distances would be NaN where the ray
+        // starts on one of its planes, and std::min() and std::max() keep or drop NaN depending on the argument order.
+        if (std::isinf(inv_direction[axis])) {
+            if (origin[axis] < node.min[axis] || origin[axis] > node.max[axis]) {
+                return FLT_MAX;
+            }
+            continue;
+        }
+
+        f32 t0 = (node.min[axis] - origin[axis]) * inv_direction[axis];
+        f32 t1 = (node.max[axis] - origin[axis]) * inv_direction[axis];
+
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+    }
+
+    return t_min <= t_max ? t_min : FLT_MAX;
+}
+
+// Möller-Trumbore
+static bool intersect_patch(const Patch &patch, const vec3 &origin, const vec3 &direction, f32 max_t, f32 &t, f32 &u, f32 &v) {
+    vec3 p0 = patch.pos[0].xyz();
+    vec3 edge1 = patch.pos[1].xyz() - p0;
+    vec3 edge2 = patch.pos[2].xyz() - p0;
+
+    vec3 p = direction.cross(edge2);
+    f32 det = edge1.dot(p);
+    if (std::abs(det) < FLT_EPSILON) {
+        return false;
+    }
+
+    f32 inv_det = 1.0f / det;
+    vec3 s = origin - p0;
+
+    u = s.dot(p) * inv_det;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+
+    vec3 q = s.cross(edge1);
+    v = direction.dot(q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+
+    t = edge2.dot(q) * inv_det;
+    return t >= 0.0f && t < max_t;
+}
+
+bool PatchBvh::raycast(const vec3 &origin, const vec3 &direction, f32 max_t, RayHit &hit) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const f32 origin_f[3]{ origin.x, origin.y, origin.z };
+    const f32 inv_direction[3]{ 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+    struct Entry {
+        u32 node{};
+        f32 t{};
+    };
+
+    Entry stack[BVH_STACK_SIZE]{};
+    u32 stack_size{};
+
+    f32 root_t = intersect_node(_nodes[0], origin_f, inv_direction, max_t);
+    if (root_t == FLT_MAX) {
+        return false;
+    }
+    stack[stack_size++] = Entry{ 0u, root_t };
+
+    bool found = false;
+    f32 closest_t = max_t;
+
+    while (stack_size > 0u) {
+        Entry entry = stack[--stack_size];
+
+        // Something closer was hit since the node was pushed
+        if (entry.t >= closest_t) {
+            continue;
+        }
+
+        const BvhNode &node = _nodes[entry.node];
+
+        if (node.count > 0u) {
+            for (u32 i = node.first; i < node.first + node.count; ++i) {
+                f32 t, u, v;
+                if (intersect_patch(_patches[_patch_indices[i]], origin, direction, closest_t, t, u, v)) {
+                    closest_t = t;
+                    found = true;
+                    hit = RayHit{ .patch_index = _patch_indices[i], .t = t, .u = u, .v = v };
+                }
+            }
+            continue;
+        }
+
+        u32 left = entry.node + 1u;
+        u32 right = node.first;
+        f32 left_t = intersect_node(_nodes[left], origin_f, inv_direction, closest_t);
+        f32 right_t = intersect_node(_nodes[right], origin_f, inv_direction, closest_t);
+
+        // The closer child is popped first
+        if (left_t > right_t) {
+            std::swap(left, right);
+            std::swap(left_t, right_t);
+        }
+
+        assert(stack_size + 2u <= BVH_STACK_SIZE);
+        if (right_t != FLT_MAX) {
+            stack[stack_size++] = Entry{ right, right_t };
+        }
+        if (left_t != FLT_MAX) {
+            stack[stack_size++] = Entry{ left, left_t };
+        }
+    }
+
+    return found;
+}
+
+static bool is_sphere_overlapping(const f32 min[3], const f32 max[3], const f32 center[3], f32 radius_sq) {
+    // Squared distance from the center to the closest point of the box
+    f32 dist_sq{};
+    for (u32 axis{}; axis < 3u; ++axis) {
+        f32 d = std::max({ min[axis] - center[axis], 0.0f, center[axis] - max[axis] });
+        dist_sq += d * d;
+    }
+
+    return dist_sq <= radius_sq;
+}
+
+void PatchBvh::query_sphere(const vec3 &center, f32 radius, std::vector<u32> &patch_indices) const {
+    patch_indices.clear();
+
+    if (_nodes.empty()) {
+        return;
+    }
+
+    const f32 center_f[3]{ center.x, center.y, center.z };
+    const f32 radius_sq = radius * radius;
+
+    u32 stack[BVH_STACK_SIZE]{};
+    u32 stack_size{};
+    stack[stack_size++] = 0u;
+
+    while (stack_size > 0u) {
+        const u32 node_index = stack[--stack_size];
+        const BvhNode &node = _nodes[node_index];
+
+        if (!is_sphere_overlapping(node.min, node.max, center_f, radius_sq)) {
+            continue;
+        }
+
+        if (node.count > 0u) {
+            for (u32 i = node.first; i < node.first + node.count; ++i) {
+                const Patch &patch = _patches[_patch_indices[i]];
+
+                vec4 min = patch.pos[0].min(patch.pos[1]).min(patch.pos[2]);
+                vec4 max = patch.pos[0].max(patch.pos[1]).max(patch.pos[2]);
+                const f32 patch_min[3]{ min.x, min.y, min.z };
+                const f32 patch_max[3]{ max.x, max.y, max.z };
+
+                if (is_sphere_overlapping(patch_min, patch_max, center_f, radius_sq)) {
+                    patch_indices.push_back(_patch_indices[i]);
+                }
+            }
+            continue;
+        }
+
+        assert(stack_size + 2u <= BVH_STACK_SIZE);
+        stack[stack_size++] = node.first;
+        stack[stack_size++] = node_index + 1u;
+    }
+}
+
+std::span<const BvhNode> PatchBvh::nodes() const {
+    return _nodes;
+}
+
+std::span<const u32> PatchBvh::patch_indices() const {
+    return _patch_indices;
+}
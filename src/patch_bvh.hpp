@@ -0,0 +1,55 @@
+#ifndef SIMD_EXPERIMENT_PATCH_BVH_HPP
+#define SIMD_EXPERIMENT_PATCH_BVH_HPP
+
+#include <span>
+#include <vector>
+
+#include "raster.hpp"
+
+// 32 bytes, two nodes per cache line. Nodes are stored depth first, so an inner node's left child directly follows it.
+struct BvhNode {
+    f32 min[3]{};
+    // Inner nodes: index of the right child, leaves: first entry in the patch indices
+    u32 first{};
+    f32 max[3]{};
+    // 0 for inner nodes
+    u32 count{};
+};
+
+struct RayHit {
+    u32 patch_index{};
+    f32 t{};
+    // Barycentric coordinates of the hit, relative to the patch's second and third vertex
+    f32 u{};
+    f32 v{};
+};
+
+// Bounding volume hierarchy over the bounds of a mesh's patches, built with a binned SAH. The top levels are built in
+// parallel. The patches are not reordered, leaves refer to them by index.
+class PatchBvh {
+public:
+    // The patches are only referenced, they have to stay valid and unmodified as long as the BVH is queried.
+    // `thread_count` of 0 uses every hardware thread.
+    void build(std::span<const Patch> patches, u32 thread_count = 0u);
+
+    // Indices of the patches in every leaf that is not completely outside of one of the clip planes, in BVH order.
+    // Same planes as the rasterizer: -w < x, y < w and 0 < z < w.
+    void frustum_cull(const mat4 &view_proj, std::vector<u32> &patch_indices) const;
+
+    // Closest patch hit by the ray within max_t, both faces of a patch are hit
+    bool raycast(const vec3 &origin, const vec3 &direction, f32 max_t, RayHit &hit) const;
+
+    // Indices of the patches whose bounds overlap the sphere, a radius of 0 queries a single point
+    void query_sphere(const vec3 &center, f32 radius, std::vector<u32> &patch_indices) const;
+
+    std::span<const BvhNode> nodes() const;
+    std::span<const u32> patch_indices() const;
+
+private:
+    std::span<const Patch> _patches{};
+
+    std::vector<BvhNode> _nodes{};
+    std::vector<u32> _patch_indices{};
+};
+
+#endif
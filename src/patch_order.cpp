@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "patch_order.hpp"
+
+static constexpr u32 MAX_GRID_COORD = (1u << PATCH_ORDER_BITS) - 1u;
+
+// Spreads the lower 10 bits so that two zero bits follow every bit
+static u32 spread_bits(u32 v) {
+    v &= 0x3FFu;
+    v = (v | (v << 16u)) & 0x030000FFu;
+    v = (v | (v << 8u)) & 0x0300F00Fu;
+    v = (v | (v << 4u)) & 0x030C30C3u;
+    v = (v | (v << 2u)) & 0x09249249u;
+    return v;
+}
+
+static u32 get_morton_code(u32 x, u32 y, u32 z) {
+    return spread_bits(x) | (spread_bits(y) << 1u) | (spread_bits(z) << 2u);
+}
+
+// Skilling's transform ("Programming the Hilbert curve", 2004): turns the coordinates into the transposed Hilbert
+// index in place, whose interleaved bits are the index itself
+static u32 get_hilbert_code(u32 x, u32 y, u32 z) {
+    u32 coords[3]{ x, y, z };
+
+    for (u32 q = 1u << (PATCH_ORDER_BITS - 1u); q > 1u; q >>= 1u) {
+        u32 p = q - 1u;
+        for (u32 i{}; i < 3u; ++i) {
+            if (coords[i] & q) {
+                coords[0] ^= p;
+            } else {
+                u32 t = (coords[0] ^ coords[i]) & p;
+                coords[0] ^= t;
+                coords[i] ^= t;
+            }
+        }
+    }
+
+    coords[1] ^= coords[0];
+    coords[2] ^= coords[1];
+
+    u32 t{};
+    for (u32 q = 1u << (PATCH_ORDER_BITS - 1u); q > 1u; q >>= 1u) {
+        if (coords[2] & q) {
+            t ^= q - 1u;
+        }
+    }
+    for (u32 &coord : coords) {
+        coord ^= t;
+    }
+
+    // The first coordinate holds the most significant bit of every triple
+    return get_morton_code(coords[2], coords[1], coords[0]);
+}
+
+u32 get_curve_code(const vec3 &point, const Bounds &bounds, PatchOrder order) {
+    if (order == PatchOrder::Source) {
+        return 0u;
+    }
+
+    auto grid_coord = [](f32 value, f32 min, f32 max) {
+        f32 extent = max - min;
+        if (extent <= 0.0f) {
+            return 0u;
+        }
+
+        f32 coord = (value - min) / extent * static_cast<f32>(MAX_GRID_COORD + 1u);
+        return static_cast<u32>(std::clamp(coord, 0.0f, static_cast<f32>(MAX_GRID_COORD)));
+    };
+
+    u32 x = grid_coord(point.x, bounds.min.x, bounds.max.x);
+    u32 y = grid_coord(point.y, bounds.min.y, bounds.max.y);
+    u32 z = grid_coord(point.z, bounds.min.z, bounds.max.z);
+
+    return order == PatchOrder::Morton ? get_morton_code(x, y, z) : get_hilbert_code(x, y, z);
+}
+
+void sort_patches(std::span<Patch> patches, PatchOrder order) {
+    if (order == PatchOrder::Source || patches.size() < 2u) {
+        return;
+    }
+
+    vec4 min = patches[0].pos[0];
+    vec4 max = patches[0].pos[0];
+    for (const Patch &patch : patches) {
+        for (const vec4 &pos : patch.pos) {
+            min = min.min(pos);
+            max = max.max(pos);
+        }
+    }
+    const Bounds bounds{ min.xyz(), max.xyz() };
+
+    // Sorting the codes together with the indices and moving every patch once is cheaper than swapping whole patches
+    std::vector<std::pair<u32, u32>> keys(patches.size());
+    for (usize i{}; i < patches.size(); ++i) {
+        const Patch &patch = patches[i];
+        vec3 centroid = (patch.pos[0].xyz() + patch.pos[1].xyz() + patch.pos[2].xyz()) / 3.0f;
+
+        keys[i] = { get_curve_code(centroid, bounds, order), static_cast<u32>(i) };
+    }
+
+    // The index breaks ties, so the sort is stable
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<Patch> sorted(patches.size());
+    for (usize i{}; i < keys.size(); ++i) {
+        sorted[i] = patches[keys[i].second];
+    }
+
+    std::copy(sorted.begin(), sorted.end(), patches.begin());
+}
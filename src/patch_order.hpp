@@ -0,0 +1,27 @@
+#ifndef SIMD_EXPERIMENT_PATCH_ORDER_HPP
+#define SIMD_EXPERIMENT_PATCH_ORDER_HPP
+
+#include <span>
+
+#include "raster.hpp"
+
+// Space filling curves over a 1024^3 grid spanning some bounds. Patches that are close on the curve are close in space,
+// and mostly close on screen as well, so the fill loops keep touching the same framebuffer lines.
+enum class PatchOrder {
+    // Keeps the order of the source, e.g. the faces of a ply file
+    Source,
+    // Z-order, cheap to compute but jumps across the bounds at every power of two boundary
+    Morton,
+    // Never jumps, consecutive cells are always neighbours
+    Hilbert
+};
+
+static constexpr u32 PATCH_ORDER_BITS = 10u;
+
+// Position of the point on the curve, points outside of the bounds are clamped into them. 0 for PatchOrder::Source.
+u32 get_curve_code(const vec3 &point, const Bounds &bounds, PatchOrder order);
+
+// Stable sort by the curve code of the patches' centroids within their own bounds
+void sort_patches(std::span<Patch> patches, PatchOrder order);
+
+#endif
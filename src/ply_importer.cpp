@@ -1,4 +1,5 @@
 #include "ply_importer.hpp"
+#include "meshlets.hpp"
 
 struct Vertex {
     f32 x{}, y{}, z{};
@@ -181,6 +182,8 @@ static bool parse_ply_header(const std::vector<char> &buffer, PLYHeader &header,
 static bool parse_vertices_bin(const std::vector<char> &buffer, std::vector<Vertex> &vertices, size_t &end_idx, const PLYHeader &header) {
     const usize PLY_VERT_SIZE = sizeof(f32) * 3 + sizeof(f32) * 3 + sizeof(u8) * 4;
 
+    vertices.reserve(vertices.size() + header.vertex_count);
+
     for (usize i{}; i < header.vertex_count; ++i) {
         Vertex vert{};
         std::memcpy(&vert, &buffer[end_idx + (i * PLY_VERT_SIZE)], sizeof(Vertex));
@@ -197,6 +200,8 @@ static bool parse_vertices_bin(const std::vector<char> &buffer, std::vector<Vert
 static bool parse_patches_bin(const std::vector<char> &buffer, std::vector<Patch> &patches, size_t &end_idx, const std::vector<Vertex> &vertices, const PLYHeader &header) {
     const usize PLY_FACE_SIZE = sizeof(u8) + sizeof(u32) * 3;
 
+    patches.reserve(patches.size() + header.face_count);
+
     for (usize i{}; i < header.face_count; ++i) {
         u8 face_size{};
         u32 face_ind[3];
@@ -255,4 +260,16 @@ bool ply_import(const std::string &path, std::vector<Patch> &patches) {
     }
 
     return true;
+}
+bool ply_import(const std::string &path, Mesh &mesh, PatchOrder order) {
+    mesh.patches.clear();
+
+    bool imported = ply_import(path, mesh.patches);
+    mesh.mark_modified();
+
+    if (imported && order != PatchOrder::Source) {
+        build_meshlets(mesh, order);
+    }
+
+    return imported;
 }
\ No newline at end of file
@@ -8,7 +8,11 @@
 #include <iostream>
 
 #include "raster.hpp"
+#include "patch_order.hpp"
 
+// Patches in the order of the file's faces
 bool ply_import(const std::string &path, std::vector<Patch> &patches);
+// Reordered into meshlets along the given curve, PatchOrder::Source keeps the file's order and builds no meshlets
+bool ply_import(const std::string &path, Mesh &mesh, PatchOrder order = PatchOrder::Hilbert);
 
 #endif
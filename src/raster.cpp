@@ -1,123 +1,341 @@
+#include <cmath>
+#include <array>
 #include <cassert>
+#include <utility>
 #include <algorithm>
-#include <chrono>
 
 #include "raster.hpp"
+#include "raster_pipeline.hpp"
+#include "raster_kernels.hpp"
 
-static inline void fill_patch_color(Framebuffer *color_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32) {
-    u32 width = color_dst->width;
-    for (i32 y = min_y_i; y < max_y_i; ++y) {
-        for (i32 x = min_x_i; x < max_x_i; ++x) {
-            color_dst->data[y * width + x] = color32;
-        }
+using DrawPatchesFn = void (*)(std::span<const Patch> patches, const DrawPatchesConfig &cfg, const RenderTarget &color_target, const RenderTarget &depth_target);
+
+template <DepthTest Test, WindingOrder FrontWinding, bool EnableBackCull, bool EnableColor, bool EnableDepth>
+static void draw_patches_specialized(std::span<const Patch> patches, const DrawPatchesConfig &cfg, const RenderTarget &color_target, const RenderTarget &depth_target) {
+    if constexpr (!EnableColor && !EnableDepth) {
+        return;
+    } else if constexpr (Test == DepthTest::Equal && !(EnableColor && EnableDepth)) {
+        // Without color there is nothing to write, without depth there is nothing to compare against
+        return;
+    } else {
+        constexpr PipelineState state{
+            .front_winding = FrontWinding,
+            .enable_back_cull = EnableBackCull,
+            .enable_color = EnableColor,
+            .enable_depth = EnableDepth,
+            .depth_test = Test
+        };
+
+        auto vertex_shader = [&cfg](const vec4 &v_in) {
+            return cfg.vertex_shader_fn(v_in, cfg.uniforms);
+        };
+        auto patch_shader = [&cfg](const Patch &patch, const vec4 &avg_ndc) {
+            return cfg.patch_shader_fn(patch, avg_ndc, cfg.uniforms);
+        };
+
+        raster::draw_patches<state>(patches, vertex_shader, patch_shader, color_target, depth_target);
     }
 }
-static inline void fill_patch_depth(Framebuffer *depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 depth32) {
-    u32 width = depth_dst->width;
-    u32 idx;
-    for (i32 y = min_y_i; y < max_y_i; ++y) {
-        for (i32 x = min_x_i; x < max_x_i; ++x) {
-            idx = y * width + x;
 
-            if (depth32 < depth_dst->data[idx]) {
-                depth_dst->data[idx] = depth32;
-            }
-        }
-    }
+template <u32 Idx>
+static constexpr DrawPatchesFn get_specialized_draw_fn() {
+    return draw_patches_specialized<
+        (Idx & 0b10000u) ? DepthTest::Equal : DepthTest::Less,
+        (Idx & 0b1000u) ? WindingOrder::CW : WindingOrder::CCW,
+        (Idx & 0b0100u) != 0u,
+        (Idx & 0b0010u) != 0u,
+        (Idx & 0b0001u) != 0u
+    >;
 }
-static inline void fill_patch_color_depth(Framebuffer *color_dst, Framebuffer *depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32, u32 depth32) {
-    assert(color_dst->width == depth_dst->width);
-    assert(color_dst->height == depth_dst->height);
 
-    u32 width = color_dst->width;
+template <u32... Idx>
+static constexpr std::array<DrawPatchesFn, sizeof...(Idx)> make_specialized_draw_fns(std::integer_sequence<u32, Idx...>) {
+    return { get_specialized_draw_fn<Idx>()... };
+}
 
-    u32 idx;
-    for (i32 y = min_y_i; y < max_y_i; ++y) {
-        for (i32 x = min_x_i; x < max_x_i; ++x) {
-            idx = y * width + x;
+// Every runtime state combination maps onto one of the compile-time specialized pipelines
+static constexpr std::array<DrawPatchesFn, 32u> SPECIALIZED_DRAW_FNS = make_specialized_draw_fns(std::make_integer_sequence<u32, 32u>{});
 
-            if (depth32 < depth_dst->data[idx]) {
-                depth_dst->data[idx] = depth32;
-                color_dst->data[idx] = color32;
-            }
+static DrawPatchesFn select_draw_fn(const DrawPatchesConfig &cfg, const RenderTarget &color_target, const RenderTarget &depth_target) {
+    u32 idx = (cfg.depth_test == DepthTest::Equal ? 0b10000u : 0u) |
+              (cfg.front_winding == WindingOrder::CW ? 0b1000u : 0u) |
+              (cfg.enable_back_cull ? 0b0100u : 0u) |
+              (color_target.valid() ? 0b0010u : 0u) |
+              (depth_target.valid() ? 0b0001u : 0u);
+
+    return SPECIALIZED_DRAW_FNS[idx];
+}
+
+static RenderTarget get_color_target(const DrawPatchesConfig &cfg) {
+    return cfg.color_buffer != nullptr ? cfg.color_buffer->target() : RenderTarget{};
+}
+static RenderTarget get_depth_target(const DrawPatchesConfig &cfg) {
+    return cfg.depth_buffer != nullptr ? cfg.depth_buffer->target() : RenderTarget{};
+}
+
+void Mesh::mark_modified() {
+    ++version;
+    meshlets.clear();
+
+    centers.x.resize(patches.size());
+    centers.y.resize(patches.size());
+    centers.z.resize(patches.size());
+    colors32.resize(patches.size());
+
+    if (patches.empty()) {
+        bounds = Bounds{};
+        return;
+    }
+
+    vec4 min = patches[0].pos[0];
+    vec4 max = patches[0].pos[0];
+    for (usize i{}; i < patches.size(); ++i) {
+        const Patch &patch = patches[i];
+        for (const auto &pos : patch.pos) {
+            min = min.min(pos);
+            max = max.max(pos);
+        }
+
+        vec4 center = (patch.pos[0] + patch.pos[1] + patch.pos[2]) / 3.0f;
+        centers.x[i] = center.x;
+        centers.y[i] = center.y;
+        centers.z[i] = center.z;
+    }
+
+    bounds = Bounds{ min.xyz(), max.xyz() };
+
+    // Packed in chunks, the colors only exist as vec3 in the patches
+    std::array<vec4, 256> colors{};
+    for (usize first{}; first < patches.size(); first += colors.size()) {
+        usize count = std::min(colors.size(), patches.size() - first);
+        for (usize i{}; i < count; ++i) {
+            colors[i] = vec4(patches[first + i].color, 1.0f);
         }
+
+        raster::pack_colors(std::span<const vec4>(colors.data(), count), colors32.data() + first);
     }
 }
 
-static WindingOrder get_winding_order(const vec4 &ndc0, const vec4 &ndc1, const vec4 &ndc2) {
-    /// Determinant of such matrix:
-    // | ndc0.x ndc0.y 1.0 |
-    // | ndc1.x ndc1.y 1.0 |
-    // | ndc2.x ndc2.y 1.0 |
+void raster::transform_patches(std::span<const Patch> patches, const mat4 &transform, std::span<vec4> ndc) {
+    assert(ndc.size() >= patches.size() * 3u && "Not enough space for the transformed vertices!");
 
-    return ((
-        ndc0.x * ndc1.y + ndc0.y * ndc2.x + ndc1.x * ndc2.y - ndc1.y * ndc2.x - ndc0.y * ndc1.x - ndc0.x * ndc2.y
-    ) < 0.0f) ? WindingOrder::CW : WindingOrder::CCW;
+#if defined(MATH_SIMD_RUNTIME_DISPATCH)
+    get_raster_kernels().transform_patches(patches.data(), patches.size(), transform, ndc.data());
+#else
+    detail::transform_patches_ndc(patches.data(), patches.size(), transform, ndc.data());
+#endif
 }
 
-void raster::draw_patch(const Patch &patch, const DrawPatchesConfig &cfg) {
-    vec4 v0_ndc = cfg.vertex_shader_fn(patch.pos[0]);
-    vec4 v1_ndc = cfg.vertex_shader_fn(patch.pos[1]);
-    vec4 v2_ndc = cfg.vertex_shader_fn(patch.pos[2]);
+void raster::pack_colors(std::span<const vec4> colors, u32 *packed) {
+#if defined(MATH_SIMD_RUNTIME_DISPATCH)
+    get_raster_kernels().pack_colors(colors.data(), colors.size(), packed);
+#else
+    detail::pack_colors_u32(colors.data(), colors.size(), packed);
+#endif
+}
 
-    WindingOrder tri_winding = get_winding_order(v0_ndc, v1_ndc, v2_ndc);
-    if (tri_winding != cfg.front_winding && cfg.enable_back_cull) {
-        return;
-    }
+mat4 raster::get_normal_matrix(const mat4 &model) {
+    vec3 a0(model.m[0][0], model.m[0][1], model.m[0][2]);
+    vec3 a1(model.m[1][0], model.m[1][1], model.m[1][2]);
+    vec3 a2(model.m[2][0], model.m[2][1], model.m[2][2]);
 
-    f32 min_x = std::min(v0_ndc.x, std::min(v1_ndc.x, v2_ndc.x));
-    f32 min_y = std::min(v0_ndc.y, std::min(v1_ndc.y, v2_ndc.y));
-    f32 min_z = std::min(v0_ndc.z, std::min(v1_ndc.z, v2_ndc.z));
-    f32 max_x = std::max(v0_ndc.x, std::max(v1_ndc.x, v2_ndc.x));
-    f32 max_y = std::max(v0_ndc.y, std::max(v1_ndc.y, v2_ndc.y));
-    f32 max_z = std::max(v0_ndc.z, std::max(v1_ndc.z, v2_ndc.z));
+    // The cofactor matrix is det * inverse transpose, its columns are the cross products of the other two columns
+    vec3 c0 = a1.cross(a2);
+    vec3 c1 = a2.cross(a0);
+    vec3 c2 = a0.cross(a1);
 
-    if (max_x <= -1.0f || min_x >= 1.0f || max_y <= -1.0f || min_y >= 1.0f || min_z <= 0.0f || max_z >= 1.0f) {
-        return;
+    // For s * rotation the cofactor matrix is s^2 * rotation. Keeps the sign of the determinant, a mirroring model would
+    // otherwise turn the normals inwards.
+    f32 det = a0.dot(c0);
+    f32 scale = det != 0.0f ? std::copysign(1.0f / (std::cbrt(std::abs(det)) * std::cbrt(std::abs(det))), det) : 1.0f;
+
+    return mat4{
+        c0.x * scale, c0.y * scale, c0.z * scale, 0.0f,
+        c1.x * scale, c1.y * scale, c1.z * scale, 0.0f,
+        c2.x * scale, c2.y * scale, c2.z * scale, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+}
+
+void raster::transform_normals(std::span<const Patch> patches, const mat4 &normal_matrix, std::span<vec3> normals) {
+    assert(normals.size() >= patches.size() && "Not enough space for the transformed normals!");
+
+#if defined(MATH_ENABLE_SIMD)
+    const __m128 col0 = _mm_load_ps(normal_matrix.m[0]);
+    const __m128 col1 = _mm_load_ps(normal_matrix.m[1]);
+    const __m128 col2 = _mm_load_ps(normal_matrix.m[2]);
+
+    for (usize i{}; i < patches.size(); ++i) {
+        const vec3 &n = patches[i].normal;
+
+        __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(n.x)), _mm_mul_ps(col1, _mm_set1_ps(n.y))), _mm_mul_ps(col2, _mm_set1_ps(n.z)));
+
+        // Same order of additions as the scalar path, with an exact square root and division so both give the same normals
+        __m128 squared = _mm_mul_ps(result, result);
+        __m128 length_sq = _mm_add_ss(_mm_add_ss(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(2, 2, 2, 2)));
+        __m128 length = _mm_sqrt_ps(_mm_shuffle_ps(length_sq, length_sq, _MM_SHUFFLE(0, 0, 0, 0)));
+
+        result = _mm_and_ps(_mm_div_ps(result, length), _mm_cmpgt_ps(length, _mm_setzero_ps()));
+        _mm_store_ps(&normals[i].x, result);
     }
+#else
+    const mat4 &m = normal_matrix;
+    for (usize i{}; i < patches.size(); ++i) {
+        const vec3 &n = patches[i].normal;
 
-    u32 width{}, height{};
-    if (cfg.color_buffer != nullptr) {
-        width = cfg.color_buffer->width;
-        height = cfg.color_buffer->height;
-    } else if (cfg.depth_buffer != nullptr) {
-        width = cfg.depth_buffer->width;
-        height = cfg.depth_buffer->height;
+        vec3 normal(
+            (m.m[0][0] * n.x + m.m[1][0] * n.y) + m.m[2][0] * n.z,
+            (m.m[0][1] * n.x + m.m[1][1] * n.y) + m.m[2][1] * n.z,
+            (m.m[0][2] * n.x + m.m[1][2] * n.y) + m.m[2][2] * n.z
+        );
+
+        f32 length = std::sqrt((normal.x * normal.x + normal.y * normal.y) + normal.z * normal.z);
+        normals[i] = length > 0.0f ? vec3(normal.x / length, normal.y / length, normal.z / length) : vec3(0.0f);
     }
+#endif
+}
 
-    i32 min_x_i = std::max(static_cast<i32>(std::floor((min_x * 0.5f + 0.5f) * static_cast<f32>(width))), 0);
-    i32 min_y_i = std::max(static_cast<i32>(std::floor((min_y * 0.5f + 0.5f) * static_cast<f32>(height))), 0);
-    i32 max_x_i = std::min(static_cast<i32>(std::ceil((max_x * 0.5f + 0.5f) * static_cast<f32>(width))), static_cast<i32>(width));
-    i32 max_y_i = std::min(static_cast<i32>(std::ceil((max_y * 0.5f + 0.5f) * static_cast<f32>(height))), static_cast<i32>(height));
+bool raster::is_bounds_visible(const Bounds &bounds, const mat4 &transform) {
+    // Outcodes of all 8 corners in clip space, the box is outside if all of them are outside of the same plane.
+    // Matches the setup's clipping: -w < x, y < w and 0 < z < w.
+    u32 outside_all = 0b111111u;
+    for (u32 i{}; i < 8u; ++i) {
+        vec4 corner(
+            (i & 1u) ? bounds.max.x : bounds.min.x,
+            (i & 2u) ? bounds.max.y : bounds.min.y,
+            (i & 4u) ? bounds.max.z : bounds.min.z,
+            1.0f
+        );
+        vec4 clip = transform * corner;
 
-    vec4 ndc_avg = (v0_ndc + v1_ndc + v2_ndc) / 3.0f;
+        u32 outside = (clip.x < -clip.w ? 0b000001u : 0u) |
+                      (clip.x > clip.w ? 0b000010u : 0u) |
+                      (clip.y < -clip.w ? 0b000100u : 0u) |
+                      (clip.y > clip.w ? 0b001000u : 0u) |
+                      (clip.z < 0.0f ? 0b010000u : 0u) |
+                      (clip.z > clip.w ? 0b100000u : 0u);
 
-    constexpr const f32 max_depth_f = static_cast<f32>(UINT32_MAX);
+        outside_all &= outside;
+    }
 
-    u32 depth32 = static_cast<u32>(ndc_avg.z * max_depth_f);
+    return outside_all == 0u;
+}
 
-    if (cfg.color_buffer != nullptr) {
-        vec4 color = cfg.patch_shader_fn(patch, ndc_avg).max(0.0f).min(1.0f);
+raster::MeshletCuller raster::make_meshlet_culler(const mat4 &transform, WindingOrder front_winding, bool enable_back_cull) {
+    const auto &m = transform.m;
 
-        u32 color32 = rgba_to_u32(color);
+    vec4 rows[4]{};
+    for (u32 r{}; r < 4u; ++r) {
+        rows[r] = vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    }
 
-        if (cfg.depth_buffer != nullptr) {
-            fill_patch_color_depth(cfg.color_buffer, cfg.depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, color32, depth32);
-        } else {
-            fill_patch_color(cfg.color_buffer, min_x_i, min_y_i, max_x_i, max_y_i, color32);
+    MeshletCuller culler{
+        .planes = {
+            rows[3] + rows[0],
+            rows[3] - rows[0],
+            rows[3] + rows[1],
+            rows[3] - rows[1],
+            rows[2],
+            rows[3] - rows[2]
+        },
+        .back_cull = enable_back_cull
+    };
+
+    // Normalized, so the distance to a plane can be compared with a sphere's radius directly
+    for (vec4 &plane : culler.planes) {
+        f32 length = plane.xyz().magnitude();
+        if (length > 0.0f) {
+            plane = plane / length;
         }
-    } else {
-        if (cfg.depth_buffer != nullptr) {
-            fill_patch_depth(cfg.depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, depth32);
+    }
+
+    // Winding determinant of a patch: det of the clip space (x, y, w) of its vertices. By Cauchy-Binet that is the sum
+    // of products of the 3x3 minors of the patch's homogeneous vertices, (n.x, -n.y, n.z, dot(n, p0)) with n the
+    // geometric normal, and of the minors of the x, y and w rows of the transform.
+    auto minor = [&](u32 skip) {
+        f32 c[3][3]{};
+        for (u32 r{}, row_index{}; r < 4u; ++r) {
+            if (r == 2u) {
+                continue;
+            }
+            for (u32 col{}, col_index{}; col < 4u; ++col) {
+                if (col == skip) {
+                    continue;
+                }
+                c[row_index][col_index++] = m[col][r];
+            }
+            ++row_index;
+        }
+
+        return c[0][0] * (c[1][1] * c[2][2] - c[1][2] * c[2][1]) -
+               c[0][1] * (c[1][0] * c[2][2] - c[1][2] * c[2][0]) +
+               c[0][2] * (c[1][0] * c[2][1] - c[1][1] * c[2][0]);
+    };
+
+    culler.eye_term = vec3(minor(0u), -minor(1u), minor(2u));
+    culler.eye_scale = minor(3u);
+
+    // A positive determinant is CCW, a back face has the winding that isn't the front one
+    culler.cull_sign = front_winding == WindingOrder::CW ? 1.0f : -1.0f;
+
+    return culler;
+}
+
+bool raster::is_meshlet_visible(const Meshlet &meshlet, const MeshletCuller &culler) {
+    const vec3 &c = meshlet.center;
+
+    // Runs for every meshlet of every instance, spelled out instead of going through vec4::dot()
+    for (const vec4 &plane : culler.planes) {
+        if (plane.x * c.x + plane.y * c.y + plane.z * c.z + plane.w < -meshlet.radius) {
+            return false;
         }
     }
+
+    if (!culler.back_cull || meshlet.cone_cos <= 0.0f) {
+        return true;
+    }
+
+    // Every patch is culled if the smallest dot(cull_sign * normal, h) over the normal cone is positive, with h the eye
+    // term at the center and the sphere's radius as a margin for the patches' actual positions
+    const vec3 &e = culler.eye_term;
+    const vec3 &a = meshlet.cone_axis;
+
+    f32 hx = e.x + c.x * culler.eye_scale;
+    f32 hy = e.y + c.y * culler.eye_scale;
+    f32 hz = e.z + c.z * culler.eye_scale;
+
+    f32 axis_dot = (a.x * hx + a.y * hy + a.z * hz) * culler.cull_sign;
+    f32 cross_x = a.y * hz - a.z * hy;
+    f32 cross_y = a.z * hx - a.x * hz;
+    f32 cross_z = a.x * hy - a.y * hx;
+
+    f32 min_dot = axis_dot * meshlet.cone_cos - std::sqrt(cross_x * cross_x + cross_y * cross_y + cross_z * cross_z) * meshlet.cone_sin;
+
+    return min_dot <= std::abs(culler.eye_scale) * meshlet.radius;
+}
+
+void raster::draw_patch(const Patch &patch, const DrawPatchesConfig &cfg) {
+    draw_patches(std::span<const Patch>(&patch, 1u), cfg, get_color_target(cfg), get_depth_target(cfg));
 }
 void raster::draw_patches(const std::vector<Patch> &patches, const DrawPatchesConfig &cfg) {
-    if (cfg.color_buffer == nullptr && cfg.depth_buffer == nullptr) {
+    draw_patches(patches, cfg, get_color_target(cfg), get_depth_target(cfg));
+}
+void raster::draw_patches(std::span<const Patch> patches, const DrawPatchesConfig &cfg, const RenderTarget &color_target, const RenderTarget &depth_target) {
+    if (!color_target.valid() && !depth_target.valid()) {
         return;
     }
 
-    for (const auto &patch : patches) {
-        draw_patch(patch, cfg);
+    if (cfg.enable_z_prepass && color_target.valid() && depth_target.valid()) {
+        DrawPatchesConfig depth_cfg = cfg;
+        depth_cfg.depth_test = DepthTest::Less;
+
+        DrawPatchesConfig color_cfg = cfg;
+        color_cfg.depth_test = DepthTest::Equal;
+
+        select_draw_fn(depth_cfg, RenderTarget{}, depth_target)(patches, depth_cfg, RenderTarget{}, depth_target);
+        select_draw_fn(color_cfg, color_target, depth_target)(patches, color_cfg, color_target, depth_target);
+        return;
     }
-}
\ No newline at end of file
+
+    select_draw_fn(cfg, color_target, depth_target)(patches, cfg, color_target, depth_target);
+}
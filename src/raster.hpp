@@ -1,7 +1,12 @@
 #ifndef SIMD_EXPERIMENT_RASTER_HPP
 #define SIMD_EXPERIMENT_RASTER_HPP
 
+#include <bit>
+#include <span>
+#include <cassert>
 #include <vector>
+#include <type_traits>
+#include <algorithm>
 #include <intrin.h>
 
 #include "types.hpp"
@@ -16,38 +21,227 @@ enum struct WindingOrder : u32 {
     CCW = 2u,
 };
 
+// Less is the regular depth test. Equal only passes the fragments that won a preceding depth-only pass (Z-prepass),
+// so every pixel's color is written at most once no matter how much overdraw there is.
+enum struct DepthTest : u32 {
+    Less = 1u,
+    Equal = 2u,
+};
+
 struct Patch {
     vec4 pos[3]{};
     vec3 normal{};
     vec3 color{};
 };
 
-typedef vec4 (*VertexShaderFn)(const vec4 &v_in);
-typedef vec4 (*PatchShaderFn)(const Patch &patch, const vec4 &avg_ndc);
+// Axis aligned box in object space
+struct Bounds {
+    vec3 min{};
+    vec3 max{};
+};
 
-// Do not allocate on stack or heap manually! Use it as a global static object.
-// It is much faster than using runtime memory.
-struct alignas(64) Framebuffer {
-    u32 data[RASTER_MAX_FB_WIDTH * RASTER_MAX_FB_HEIGHT]{};
+static constexpr u32 RASTER_MESHLET_MAX_PATCHES = 64u;
+
+// Consecutive patches of a mesh that are culled together, before any of their vertices are transformed.
+// The cone contains the geometric normals of all patches, cone_cos <= 0 means that they are too spread for back-face culling.
+struct Meshlet {
+    vec3 center{};
+    f32 radius{};
+    vec3 cone_axis{};
+    f32 cone_cos{};
+    f32 cone_sin{};
+    u32 first{};
+    u32 count{};
+};
+
+// Centers of a mesh's patches, one stream per component so that they can be loaded 8 patches at a time.
+// The patch positions are points, the centers' w is always 1.0.
+struct PatchCenters {
+    std::vector<f32> x{};
+    std::vector<f32> y{};
+    std::vector<f32> z{};
+};
+
+// Patches together with a version that has to be bumped after every modification, so that results derived from them
+// (e.g. cached shadow maps) know when to be rebuilt
+struct Mesh {
+    std::vector<Patch> patches{};
+    std::vector<Meshlet> meshlets{};
+    Bounds bounds{};
+    // Derived from the patches by mark_modified() like the bounds, so per-frame passes don't recompute them
+    PatchCenters centers{};
+    // The patch colors packed like the output of an unlit shader, opaque, see raster::prepacked_color_shader()
+    std::vector<u32> colors32{};
+    u64 version{};
+
+    // Call after the patches were modified, also refits the bounds and derives the centers and packed colors.
+    // The meshlets are dropped, see build_meshlets().
+    void mark_modified();
+};
+
+// Shaders get the draw's uniform block instead of reading globals, so draws can be recorded ahead and run concurrently
+typedef vec4 (*VertexShaderFn)(const vec4 &v_in, const void *uniforms);
+typedef vec4 (*PatchShaderFn)(const Patch &patch, const vec4 &avg_ndc, const void *uniforms);
+
+// Same as above, but taking the uniform block by its actual type. Bind them with raster::bind_shaders().
+template <typename Uniforms>
+using TypedVertexShaderFn = vec4 (*)(const vec4 &v_in, const Uniforms &uniforms);
+template <typename Uniforms>
+using TypedPatchShaderFn = vec4 (*)(const Patch &patch, const vec4 &avg_ndc, const Uniforms &uniforms);
+
+// Framebuffers are split into square tiles to track which of their parts have to be redrawn
+static constexpr u32 RASTER_TILE_SIZE = 64u;
+static constexpr u32 RASTER_MAX_TILES_X = (RASTER_MAX_FB_WIDTH + RASTER_TILE_SIZE - 1u) / RASTER_TILE_SIZE;
+static constexpr u32 RASTER_MAX_TILES_Y = (RASTER_MAX_FB_HEIGHT + RASTER_TILE_SIZE - 1u) / RASTER_TILE_SIZE;
+
+static_assert(RASTER_MAX_TILES_X <= 64u, "A row of tiles has to fit into a single TileMask row!");
+
+// One bit per tile, one u64 per row of tiles
+struct TileMask {
+    u64 rows[RASTER_MAX_TILES_Y]{};
+
+    static constexpr inline u64 row_bits(u32 min_tile_x, u32 max_tile_x) {
+        return (~0ull >> (63u - max_tile_x)) & (~0ull << min_tile_x);
+    }
+
+    inline void clear() {
+        for (u64 &row : rows) {
+            row = 0ull;
+        }
+    }
+    inline void set_all(u32 width, u32 height) {
+        clear();
+        set_pixel_rect(0, 0, static_cast<i32>(width), static_cast<i32>(height));
+    }
+
+    // Marks every tile overlapping the half-open pixel rect
+    inline void set_pixel_rect(i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i) {
+        if (min_x_i >= max_x_i || min_y_i >= max_y_i) {
+            return;
+        }
+
+        u64 bits = row_bits(static_cast<u32>(min_x_i) / RASTER_TILE_SIZE, static_cast<u32>(max_x_i - 1) / RASTER_TILE_SIZE);
+        for (u32 ty = static_cast<u32>(min_y_i) / RASTER_TILE_SIZE; ty <= static_cast<u32>(max_y_i - 1) / RASTER_TILE_SIZE; ++ty) {
+            rows[ty] |= bits;
+        }
+    }
+
+    inline bool any() const {
+        u64 acc{};
+        for (u64 row : rows) {
+            acc |= row;
+        }
+
+        return acc != 0ull;
+    }
+    inline bool intersects(const TileMask &other) const {
+        u64 acc{};
+        for (u32 ty{}; ty < RASTER_MAX_TILES_Y; ++ty) {
+            acc |= rows[ty] & other.rows[ty];
+        }
+
+        return acc != 0ull;
+    }
+
+    inline TileMask &operator|=(const TileMask &other) {
+        for (u32 ty{}; ty < RASTER_MAX_TILES_Y; ++ty) {
+            rows[ty] |= other.rows[ty];
+        }
+
+        return *this;
+    }
+};
+
+// Non-owning view of a framebuffer's pixels. The pipelines draw into views, so that any storage can be a target.
+// A view without data means "no target".
+struct RenderTarget {
+    u32 *data{};
     u32 width{};
     u32 height{};
 
-    inline void fill(u32 value) {
+    inline bool valid() const {
+        return data != nullptr;
+    }
+
+    inline void fill(u32 value) const {
         for (u32 y{}; y < height; ++y) {
             for (u32 x{}; x < width; ++x) {
                 data[y * width + x] = value;
             }
         }
     }
+
+    // Fills only the tiles set in the mask
+    inline void fill_tiles(const TileMask &mask, u32 value) const {
+        for (u32 y{}; y < height; ++y) {
+            u64 row = mask.rows[y / RASTER_TILE_SIZE];
+
+            while (row != 0ull) {
+                u32 run_start = static_cast<u32>(std::countr_zero(row));
+                u32 run_end = run_start + static_cast<u32>(std::countr_one(row >> run_start));
+
+                for (u32 x = run_start * RASTER_TILE_SIZE; x < std::min(run_end * RASTER_TILE_SIZE, width); ++x) {
+                    data[y * width + x] = value;
+                }
+
+                row &= ~TileMask::row_bits(run_start, run_end - 1u);
+            }
+        }
+    }
+};
+
+// Do not allocate on stack or heap manually! Use it as a global static object.
+// It is much faster than using runtime memory.
+struct alignas(64) Framebuffer {
+    u32 data[RASTER_MAX_FB_WIDTH * RASTER_MAX_FB_HEIGHT]{};
+    u32 width{};
+    u32 height{};
+
+    inline RenderTarget target() {
+        return RenderTarget{ data, width, height };
+    }
+
+    inline void fill(u32 value) {
+        target().fill(value);
+    }
+    inline void fill_tiles(const TileMask &mask, u32 value) {
+        target().fill_tiles(mask, value);
+    }
+};
+
+// Heap allocated framebuffer for targets whose size is only known at runtime, e.g. shadow cascades
+struct DynamicFramebuffer {
+    std::vector<u32> data{};
+    u32 width{};
+    u32 height{};
+
+    inline void resize(u32 new_width, u32 new_height) {
+        assert(new_width <= RASTER_MAX_FB_WIDTH && new_height <= RASTER_MAX_FB_HEIGHT);
+
+        width = new_width;
+        height = new_height;
+        data.resize(static_cast<usize>(width) * static_cast<usize>(height));
+    }
+
+    inline RenderTarget target() {
+        return RenderTarget{ data.data(), width, height };
+    }
 };
 
 struct DrawPatchesConfig {
     WindingOrder front_winding = WindingOrder::CCW;
     bool enable_back_cull = true;
+    DepthTest depth_test = DepthTest::Less;
+
+    // Draws depth only first and then color with an Equal depth test, needs both buffers
+    bool enable_z_prepass = false;
 
     VertexShaderFn vertex_shader_fn{};
     PatchShaderFn patch_shader_fn{};
 
+    // Passed to both shaders. It is never written to during a draw and has to outlive it.
+    const void *uniforms{};
+
     Framebuffer *color_buffer{};
     Framebuffer *depth_buffer{};
 };
@@ -57,8 +251,78 @@ namespace raster {
         return ((((u32)(rgba.w * 255.0f) & 0xff) << 24) | ((u32)(rgba.x * 255.0f) & 0xff) << 16) | (((u32)(rgba.y * 255.0f) & 0xff) << 8) | ((u32)(rgba.z * 255.0f) & 0xff);
     }
 
+    // Transforms all patch vertices by `transform` and divides by w, with the transform kernel of the selected SIMD tier.
+    // Writes 3 entries per patch to `ndc`.
+    void transform_patches(std::span<const Patch> patches, const mat4 &transform, std::span<vec4> ndc);
+
+    // rgba_to_u32() for many colors at once, clamped to [0, 1] first like the shaded colors, with the pack kernel of the
+    // selected SIMD tier. Writes packed[0, colors.size()).
+    void pack_colors(std::span<const vec4> colors, u32 *packed);
+
+    // Matrix for the normals of a mesh placed by `model`: the inverse transpose of its upper 3x3, scaled so that rotations
+    // and uniform scales keep the normals' lengths. Only the upper 3x3 of the result is used.
+    mat4 get_normal_matrix(const mat4 &model);
+
+    // Transforms every patch's normal by the upper 3x3 of `normal_matrix` and normalizes it again, which non-uniform
+    // scales need. Writes 1 entry per patch to `normals`.
+    void transform_normals(std::span<const Patch> patches, const mat4 &normal_matrix, std::span<vec3> normals);
+
+    // False if the box is completely outside of one of the clip planes after being transformed by `transform`
+    bool is_bounds_visible(const Bounds &bounds, const mat4 &transform);
+
+    // Everything needed to cull meshlets under one transform
+    struct MeshletCuller {
+        // Normalized clip planes in object space, inside where dot(plane, point) >= 0
+        vec4 planes[6]{};
+
+        // The screen space winding of a patch has the sign of dot(normal, eye_term + eye_scale * position), the same
+        // formula covers perspective and orthographic projections. Patches are culled when the sign equals cull_sign.
+        vec3 eye_term{};
+        f32 eye_scale{};
+        f32 cull_sign{};
+        bool back_cull{};
+    };
+
+    MeshletCuller make_meshlet_culler(const mat4 &transform, WindingOrder front_winding, bool enable_back_cull);
+
+    // False if the meshlet's bounding sphere is outside of a clip plane, or if all of its patches face away
+    bool is_meshlet_visible(const Meshlet &meshlet, const MeshletCuller &culler);
+
+    namespace detail {
+        template <typename Uniforms, auto Fn>
+        inline vec4 erased_vertex_shader(const vec4 &v_in, const void *uniforms) {
+            return Fn(v_in, *static_cast<const Uniforms *>(uniforms));
+        }
+        template <typename Uniforms, auto Fn>
+        inline vec4 erased_patch_shader(const Patch &patch, const vec4 &avg_ndc, const void *uniforms) {
+            return Fn(patch, avg_ndc, *static_cast<const Uniforms *>(uniforms));
+        }
+    }
+
+    // Sets the shaders and the uniform block of the config, checking that the shaders expect this type of uniforms.
+    // Depth-only draws can leave out the patch shader.
+    template <auto VertexShader, auto PatchShader = nullptr, typename Uniforms>
+    inline void bind_shaders(DrawPatchesConfig &cfg, const Uniforms *uniforms) {
+        static_assert(std::is_convertible_v<decltype(VertexShader), TypedVertexShaderFn<Uniforms>>, "The vertex shader does not take these uniforms!");
+
+        cfg.vertex_shader_fn = detail::erased_vertex_shader<Uniforms, VertexShader>;
+
+        if constexpr (std::is_null_pointer_v<decltype(PatchShader)>) {
+            cfg.patch_shader_fn = nullptr;
+        } else {
+            static_assert(std::is_convertible_v<decltype(PatchShader), TypedPatchShaderFn<Uniforms>>, "The patch shader does not take these uniforms!");
+
+            cfg.patch_shader_fn = detail::erased_patch_shader<Uniforms, PatchShader>;
+        }
+
+        cfg.uniforms = uniforms;
+    }
+
     void draw_patch(const Patch &patch, const DrawPatchesConfig &cfg);
     void draw_patches(const std::vector<Patch> &patches, const DrawPatchesConfig &cfg);
+
+    // Draws into the given targets instead of the config's buffers, invalid targets are not written to
+    void draw_patches(std::span<const Patch> patches, const DrawPatchesConfig &cfg, const RenderTarget &color_target, const RenderTarget &depth_target);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "raster_kernels.hpp"
+
+static constexpr raster::RasterKernels SCALAR_KERNELS = raster::make_raster_kernels<SimdTier::Scalar>();
+
+#if defined(MATH_ENABLE_SIMD)
+static constexpr raster::RasterKernels SSE_KERNELS = raster::make_raster_kernels<SimdTier::SSE>();
+#endif
+
+// Without runtime dispatch this file is compiled for AVX2 already, the AVX2 kernels are instantiated here
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+static constexpr raster::RasterKernels AVX2_KERNELS = raster::make_raster_kernels<SimdTier::AVX2>();
+#endif
+
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX512)
+static constexpr raster::RasterKernels AVX512_KERNELS = raster::make_raster_kernels<SimdTier::AVX512>();
+#endif
+
+static const raster::RasterKernels *get_built_kernels(SimdTier tier) {
+    switch (tier) {
+        case SimdTier::Scalar:
+            return &SCALAR_KERNELS;
+        case SimdTier::SSE:
+#if defined(MATH_ENABLE_SIMD)
+            return &SSE_KERNELS;
+#else
+            return nullptr;
+#endif
+        case SimdTier::AVX2:
+#if defined(MATH_SIMD_RUNTIME_DISPATCH)
+            return &raster::detail::get_avx2_raster_kernels();
+#elif defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+            return &AVX2_KERNELS;
+#else
+            return nullptr;
+#endif
+        case SimdTier::AVX512:
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX512)
+            return &AVX512_KERNELS;
+#elif defined(MATH_ENABLE_SIMD)
+            return &raster::detail::get_avx512_raster_kernels();
+#else
+            return nullptr;
+#endif
+    }
+
+    return nullptr;
+}
+
+const raster::RasterKernels *raster::get_raster_kernels(SimdTier tier) {
+    if (!is_simd_tier_supported(tier)) {
+        return nullptr;
+    }
+
+    return get_built_kernels(tier);
+}
+
+const raster::RasterKernels &raster::get_raster_kernels() {
+#if !defined(MATH_SIMD_RUNTIME_DISPATCH)
+    // The pipeline calls the compiled tier directly, the binary does not run without it anyway
+    return *get_built_kernels(SIMD_COMPILED_TIER);
+#else
+    static const RasterKernels &kernels = []() -> const RasterKernels & {
+        for (u32 tier = static_cast<u32>(get_best_simd_tier()); tier > 0u; --tier) {
+            if (const RasterKernels *built = get_raster_kernels(static_cast<SimdTier>(tier))) {
+                return *built;
+            }
+        }
+
+        return SCALAR_KERNELS;
+    }();
+
+    return kernels;
+#endif
+}
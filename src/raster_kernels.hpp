@@ -0,0 +1,625 @@
+#ifndef SIMD_EXPERIMENT_RASTER_KERNELS_HPP
+#define SIMD_EXPERIMENT_RASTER_KERNELS_HPP
+
+#include <algorithm>
+
+#include "raster.hpp"
+#include "cpu_features.hpp"
+
+// The bulk loops of the pipeline, written once per SimdTier. Only the branch of the requested tier is instantiated, so a
+// translation unit can instantiate the tiers its compiler flags allow and no others.
+//
+// With MATH_SIMD_RUNTIME_DISPATCH the rest of the build only assumes SSE4.1. The AVX2 instances then live in
+// raster_kernels_avx2.cpp, the only file compiled with -mavx2, and the pipeline calls every kernel through the table
+// picked at startup. Without it the kernels of the compiled tier are called directly and inlined as before.
+// The AVX-512 instances live in raster_kernels_avx512.cpp unless the whole build targets AVX-512 (MATH_SIMD_AVX512).
+namespace raster {
+    namespace detail {
+        // Lanes [0, count) set, the rest cleared. Only instantiated for the AVX tiers, files built without AVX never see
+        // a 256 bit return value.
+        template <SimdTier Tier>
+        inline __m256i tail_mask(i32 count) {
+            return _mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        }
+
+        // Lanes of a 16 wide step starting at x that lie within the row, all of them except at the end of the row
+        template <SimdTier Tier>
+        inline __mmask16 row_mask(i32 x, i32 max_x_i) {
+            return max_x_i - x >= 16 ? static_cast<__mmask16>(0xFFFFu) : static_cast<__mmask16>((1u << (max_x_i - x)) - 1u);
+        }
+
+        template <SimdTier Tier = SIMD_COMPILED_TIER>
+        inline void fill_patch_color(const RenderTarget &color_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32) {
+            u32 width = color_dst.width;
+
+            if constexpr (Tier == SimdTier::AVX512) {
+                const __m512i color = _mm512_set1_epi32(static_cast<i32>(color32));
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 *row = color_dst.data + y * width;
+
+                    for (i32 x = min_x_i; x < max_x_i; x += 16) {
+                        _mm512_mask_storeu_epi32(row + x, row_mask<Tier>(x, max_x_i), color);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::AVX2) {
+                const __m256i color = _mm256_set1_epi32(static_cast<i32>(color32));
+                const __m256i tail = tail_mask<Tier>((max_x_i - min_x_i) & 7);
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 *row = color_dst.data + y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 8 <= max_x_i; x += 8) {
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(row + x), color);
+                    }
+                    if (x < max_x_i) {
+                        _mm256_maskstore_epi32(reinterpret_cast<i32 *>(row + x), tail, color);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::SSE) {
+                const __m128i color = _mm_set1_epi32(static_cast<i32>(color32));
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 *row = color_dst.data + y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 4 <= max_x_i; x += 4) {
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), color);
+                    }
+                    for (; x < max_x_i; ++x) {
+                        row[x] = color32;
+                    }
+                }
+            } else {
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    for (i32 x = min_x_i; x < max_x_i; ++x) {
+                        color_dst.data[y * width + x] = color32;
+                    }
+                }
+            }
+        }
+
+        // Depth-only fill, stores min(stored, depth32). No per-pixel branch, so it vectorizes into plain min-stores.
+        template <SimdTier Tier = SIMD_COMPILED_TIER>
+        inline void fill_patch_depth(const RenderTarget &depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 depth32) {
+            u32 width = depth_dst.width;
+
+            if constexpr (Tier == SimdTier::AVX512) {
+                const __m512i depth = _mm512_set1_epi32(static_cast<i32>(depth32));
+
+                // Only the pixels that get closer are written
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 *row = depth_dst.data + y * width;
+
+                    for (i32 x = min_x_i; x < max_x_i; x += 16) {
+                        __mmask16 lanes = row_mask<Tier>(x, max_x_i);
+                        __mmask16 closer = _mm512_mask_cmplt_epu32_mask(lanes, depth, _mm512_maskz_loadu_epi32(lanes, row + x));
+                        _mm512_mask_storeu_epi32(row + x, closer, depth);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::AVX2) {
+                const __m256i depth = _mm256_set1_epi32(static_cast<i32>(depth32));
+                const __m256i tail = tail_mask<Tier>((max_x_i - min_x_i) & 7);
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 *row = depth_dst.data + y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 8 <= max_x_i; x += 8) {
+                        __m256i *dst = reinterpret_cast<__m256i *>(row + x);
+                        _mm256_storeu_si256(dst, _mm256_min_epu32(_mm256_loadu_si256(dst), depth));
+                    }
+
+                    // Masked off lanes are neither read nor written, so the tail never touches the neighbouring pixels
+                    if (x < max_x_i) {
+                        i32 *dst = reinterpret_cast<i32 *>(row + x);
+                        _mm256_maskstore_epi32(dst, tail, _mm256_min_epu32(_mm256_maskload_epi32(dst, tail), depth));
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::SSE) {
+                const __m128i depth = _mm_set1_epi32(static_cast<i32>(depth32));
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 *row = depth_dst.data + y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 4 <= max_x_i; x += 4) {
+                        __m128i *dst = reinterpret_cast<__m128i *>(row + x);
+                        _mm_storeu_si128(dst, _mm_min_epu32(_mm_loadu_si128(dst), depth));
+                    }
+                    for (; x < max_x_i; ++x) {
+                        row[x] = std::min(row[x], depth32);
+                    }
+                }
+            } else {
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 *row = depth_dst.data + y * width;
+
+                    for (i32 x = min_x_i; x < max_x_i; ++x) {
+                        row[x] = std::min(row[x], depth32);
+                    }
+                }
+            }
+        }
+
+        template <SimdTier Tier = SIMD_COMPILED_TIER>
+        inline void fill_patch_color_depth(const RenderTarget &color_dst, const RenderTarget &depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32, u32 depth32) {
+            u32 width = color_dst.width;
+
+            if constexpr (Tier == SimdTier::AVX512) {
+                const __m512i depth = _mm512_set1_epi32(static_cast<i32>(depth32));
+                const __m512i color = _mm512_set1_epi32(static_cast<i32>(color32));
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 idx = y * width;
+
+                    for (i32 x = min_x_i; x < max_x_i; x += 16) {
+                        __mmask16 lanes = row_mask<Tier>(x, max_x_i);
+                        __mmask16 closer = _mm512_mask_cmplt_epu32_mask(lanes, depth, _mm512_maskz_loadu_epi32(lanes, depth_dst.data + idx + x));
+
+                        _mm512_mask_storeu_epi32(depth_dst.data + idx + x, closer, depth);
+                        _mm512_mask_storeu_epi32(color_dst.data + idx + x, closer, color);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::AVX2) {
+                // There is no unsigned compare, flipping the sign bit of both sides turns it into a signed one
+                const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+                const __m256i depth = _mm256_set1_epi32(static_cast<i32>(depth32));
+                const __m256i depth_signed = _mm256_xor_si256(depth, sign);
+                const __m256i color = _mm256_set1_epi32(static_cast<i32>(color32));
+                const __m256i tail = tail_mask<Tier>((max_x_i - min_x_i) & 7);
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 idx = y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 8 <= max_x_i; x += 8) {
+                        __m256i *depth_ptr = reinterpret_cast<__m256i *>(depth_dst.data + idx + x);
+                        __m256i stored = _mm256_loadu_si256(depth_ptr);
+                        __m256i closer = _mm256_cmpgt_epi32(_mm256_xor_si256(stored, sign), depth_signed);
+
+                        _mm256_storeu_si256(depth_ptr, _mm256_min_epu32(stored, depth));
+                        _mm256_maskstore_epi32(reinterpret_cast<i32 *>(color_dst.data + idx + x), closer, color);
+                    }
+                    if (x < max_x_i) {
+                        i32 *depth_ptr = reinterpret_cast<i32 *>(depth_dst.data + idx + x);
+                        __m256i stored = _mm256_maskload_epi32(depth_ptr, tail);
+                        __m256i closer = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_xor_si256(stored, sign), depth_signed), tail);
+
+                        _mm256_maskstore_epi32(depth_ptr, closer, depth);
+                        _mm256_maskstore_epi32(reinterpret_cast<i32 *>(color_dst.data + idx + x), closer, color);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::SSE) {
+                const __m128i sign = _mm_set1_epi32(INT32_MIN);
+                const __m128i depth = _mm_set1_epi32(static_cast<i32>(depth32));
+                const __m128i depth_signed = _mm_xor_si128(depth, sign);
+                const __m128i color = _mm_set1_epi32(static_cast<i32>(color32));
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 idx = y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 4 <= max_x_i; x += 4) {
+                        __m128i *depth_ptr = reinterpret_cast<__m128i *>(depth_dst.data + idx + x);
+                        __m128i *color_ptr = reinterpret_cast<__m128i *>(color_dst.data + idx + x);
+                        __m128i stored = _mm_loadu_si128(depth_ptr);
+                        __m128i closer = _mm_cmpgt_epi32(_mm_xor_si128(stored, sign), depth_signed);
+
+                        // No masked store before AVX, the color row is blended and written back whole
+                        _mm_storeu_si128(depth_ptr, _mm_min_epu32(stored, depth));
+                        _mm_storeu_si128(color_ptr, _mm_blendv_epi8(_mm_loadu_si128(color_ptr), color, closer));
+                    }
+                    for (; x < max_x_i; ++x) {
+                        if (depth32 < depth_dst.data[idx + x]) {
+                            depth_dst.data[idx + x] = depth32;
+                            color_dst.data[idx + x] = color32;
+                        }
+                    }
+                }
+            } else {
+                u32 idx;
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    for (i32 x = min_x_i; x < max_x_i; ++x) {
+                        idx = y * width + x;
+
+                        if (depth32 < depth_dst.data[idx]) {
+                            depth_dst.data[idx] = depth32;
+                            color_dst.data[idx] = color32;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Color pass after a Z-prepass: writes color only where the stored depth is exactly the patch depth
+        template <SimdTier Tier = SIMD_COMPILED_TIER>
+        inline void fill_patch_color_depth_equal(const RenderTarget &color_dst, const RenderTarget &depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32, u32 depth32) {
+            u32 width = color_dst.width;
+
+            if constexpr (Tier == SimdTier::AVX512) {
+                const __m512i depth = _mm512_set1_epi32(static_cast<i32>(depth32));
+                const __m512i color = _mm512_set1_epi32(static_cast<i32>(color32));
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 idx = y * width;
+
+                    for (i32 x = min_x_i; x < max_x_i; x += 16) {
+                        __mmask16 lanes = row_mask<Tier>(x, max_x_i);
+                        __mmask16 equal = _mm512_mask_cmpeq_epu32_mask(lanes, depth, _mm512_maskz_loadu_epi32(lanes, depth_dst.data + idx + x));
+
+                        _mm512_mask_storeu_epi32(color_dst.data + idx + x, equal, color);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::AVX2) {
+                const __m256i depth = _mm256_set1_epi32(static_cast<i32>(depth32));
+                const __m256i color = _mm256_set1_epi32(static_cast<i32>(color32));
+                const __m256i tail = tail_mask<Tier>((max_x_i - min_x_i) & 7);
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 idx = y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 8 <= max_x_i; x += 8) {
+                        __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(depth_dst.data + idx + x)), depth);
+                        _mm256_maskstore_epi32(reinterpret_cast<i32 *>(color_dst.data + idx + x), equal, color);
+                    }
+                    if (x < max_x_i) {
+                        __m256i equal = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_maskload_epi32(reinterpret_cast<const i32 *>(depth_dst.data + idx + x), tail), depth), tail);
+                        _mm256_maskstore_epi32(reinterpret_cast<i32 *>(color_dst.data + idx + x), equal, color);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::SSE) {
+                const __m128i depth = _mm_set1_epi32(static_cast<i32>(depth32));
+                const __m128i color = _mm_set1_epi32(static_cast<i32>(color32));
+
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    u32 idx = y * width;
+
+                    i32 x = min_x_i;
+                    for (; x + 4 <= max_x_i; x += 4) {
+                        __m128i *color_ptr = reinterpret_cast<__m128i *>(color_dst.data + idx + x);
+                        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(depth_dst.data + idx + x)), depth);
+                        _mm_storeu_si128(color_ptr, _mm_blendv_epi8(_mm_loadu_si128(color_ptr), color, equal));
+                    }
+                    for (; x < max_x_i; ++x) {
+                        if (depth_dst.data[idx + x] == depth32) {
+                            color_dst.data[idx + x] = color32;
+                        }
+                    }
+                }
+            } else {
+                u32 idx;
+                for (i32 y = min_y_i; y < max_y_i; ++y) {
+                    for (i32 x = min_x_i; x < max_x_i; ++x) {
+                        idx = y * width + x;
+
+                        if (depth_dst.data[idx] == depth32) {
+                            color_dst.data[idx] = color32;
+                        }
+                    }
+                }
+            }
+        }
+
+        // NDC of the same vertex of 4 patches, SoA in and out. Summed in the same order for every tier.
+        static inline void transform_soa(const __m128 m[4][4], __m128 px, __m128 py, __m128 pz, __m128 pw, __m128 out[4]) {
+            for (u32 r{}; r < 4u; ++r) {
+                out[r] = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(m[0][r], px), _mm_mul_ps(m[1][r], py)),
+                    _mm_add_ps(_mm_mul_ps(m[2][r], pz), _mm_mul_ps(m[3][r], pw))
+                );
+            }
+
+            // Same as vec4 / w, w itself ends up as 1.0
+            __m128 w = out[3];
+            out[0] = _mm_div_ps(out[0], w);
+            out[1] = _mm_div_ps(out[1], w);
+            out[2] = _mm_div_ps(out[2], w);
+            out[3] = _mm_div_ps(out[3], w);
+        }
+
+        // 4x4 transpose within each 128 bit lane, like _MM_TRANSPOSE4_PS. The zero-masked forms with a full mask are the
+        // same instructions, GCC 12 warns about the undefined pass-through value of the plain ones.
+        template <SimdTier Tier>
+        inline void transpose_lanes(const __m512 in[4], __m512 out[4]) {
+            const __mmask16 all = 0xFFFFu;
+            const __mmask8 all_pd = 0xFFu;
+
+            __m512d t0 = _mm512_castps_pd(_mm512_maskz_unpacklo_ps(all, in[0], in[1]));
+            __m512d t1 = _mm512_castps_pd(_mm512_maskz_unpacklo_ps(all, in[2], in[3]));
+            __m512d t2 = _mm512_castps_pd(_mm512_maskz_unpackhi_ps(all, in[0], in[1]));
+            __m512d t3 = _mm512_castps_pd(_mm512_maskz_unpackhi_ps(all, in[2], in[3]));
+
+            out[0] = _mm512_castpd_ps(_mm512_maskz_unpacklo_pd(all_pd, t0, t1));
+            out[1] = _mm512_castpd_ps(_mm512_maskz_unpackhi_pd(all_pd, t0, t1));
+            out[2] = _mm512_castpd_ps(_mm512_maskz_unpacklo_pd(all_pd, t2, t3));
+            out[3] = _mm512_castpd_ps(_mm512_maskz_unpackhi_pd(all_pd, t2, t3));
+        }
+
+        // All 3 vertices of `count` patches transformed by `transform` and divided by w, written to ndc[0, count * 3)
+        template <SimdTier Tier = SIMD_COMPILED_TIER>
+        inline void transform_patches_ndc(const Patch *patches, usize count, const mat4 &transform, vec4 *ndc) {
+            usize i{};
+
+            if constexpr (Tier == SimdTier::AVX512) {
+                __m512 m[4][4];
+                for (u32 c{}; c < 4u; ++c) {
+                    for (u32 r{}; r < 4u; ++r) {
+                        m[c][r] = _mm512_set1_ps(transform.m[c][r]);
+                    }
+                }
+
+                // 16 patches at a time. Register j holds the vertex of patches j, 4 + j, 8 + j and 12 + j in its 128 bit
+                // lanes, the in-lane transpose then gives x, y, z and w of patches [0, 16) in order.
+                for (; i + 16u <= count; i += 16u) {
+                    for (u32 k{}; k < 3u; ++k) {
+                        __m512 rows[4];
+                        for (u32 j{}; j < 4u; ++j) {
+                            __m512 row = _mm512_castps128_ps512(_mm_load_ps(&patches[i + j].pos[k].x));
+                            row = _mm512_insertf32x4(row, _mm_load_ps(&patches[i + 4u + j].pos[k].x), 1);
+                            row = _mm512_insertf32x4(row, _mm_load_ps(&patches[i + 8u + j].pos[k].x), 2);
+                            rows[j] = _mm512_insertf32x4(row, _mm_load_ps(&patches[i + 12u + j].pos[k].x), 3);
+                        }
+
+                        __m512 p[4];
+                        transpose_lanes<Tier>(rows, p);
+
+                        __m512 out[4];
+                        for (u32 r{}; r < 4u; ++r) {
+                            out[r] = _mm512_add_ps(
+                                _mm512_add_ps(_mm512_mul_ps(m[0][r], p[0]), _mm512_mul_ps(m[1][r], p[1])),
+                                _mm512_add_ps(_mm512_mul_ps(m[2][r], p[2]), _mm512_mul_ps(m[3][r], p[3]))
+                            );
+                        }
+
+                        __m512 w = out[3];
+                        out[0] = _mm512_div_ps(out[0], w);
+                        out[1] = _mm512_div_ps(out[1], w);
+                        out[2] = _mm512_div_ps(out[2], w);
+                        out[3] = _mm512_div_ps(out[3], w);
+
+                        // Back to one vertex per lane, lane l of register j is patch 4 * l + j
+                        transpose_lanes<Tier>(out, rows);
+
+                        for (u32 j{}; j < 4u; ++j) {
+                            _mm_store_ps(&ndc[(i + j) * 3u + k].x, _mm512_maskz_extractf32x4_ps(0xFu, rows[j], 0));
+                            _mm_store_ps(&ndc[(i + 4u + j) * 3u + k].x, _mm512_maskz_extractf32x4_ps(0xFu, rows[j], 1));
+                            _mm_store_ps(&ndc[(i + 8u + j) * 3u + k].x, _mm512_maskz_extractf32x4_ps(0xFu, rows[j], 2));
+                            _mm_store_ps(&ndc[(i + 12u + j) * 3u + k].x, _mm512_maskz_extractf32x4_ps(0xFu, rows[j], 3));
+                        }
+                    }
+                }
+            }
+
+            // AVX-512 continues with 8 patches at a time
+            if constexpr (Tier == SimdTier::AVX2 || Tier == SimdTier::AVX512) {
+                __m256 m[4][4];
+                for (u32 c{}; c < 4u; ++c) {
+                    for (u32 r{}; r < 4u; ++r) {
+                        m[c][r] = _mm256_set1_ps(transform.m[c][r]);
+                    }
+                }
+
+                // The same vertex of 8 patches at a time: AoS -> SoA, transform, divide, SoA -> AoS
+                for (; i + 8u <= count; i += 8u) {
+                    for (u32 k{}; k < 3u; ++k) {
+                        __m128 r0 = _mm_load_ps(&patches[i + 0u].pos[k].x);
+                        __m128 r1 = _mm_load_ps(&patches[i + 1u].pos[k].x);
+                        __m128 r2 = _mm_load_ps(&patches[i + 2u].pos[k].x);
+                        __m128 r3 = _mm_load_ps(&patches[i + 3u].pos[k].x);
+                        __m128 r4 = _mm_load_ps(&patches[i + 4u].pos[k].x);
+                        __m128 r5 = _mm_load_ps(&patches[i + 5u].pos[k].x);
+                        __m128 r6 = _mm_load_ps(&patches[i + 6u].pos[k].x);
+                        __m128 r7 = _mm_load_ps(&patches[i + 7u].pos[k].x);
+                        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                        _MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+
+                        __m256 px = _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r4, 1);
+                        __m256 py = _mm256_insertf128_ps(_mm256_castps128_ps256(r1), r5, 1);
+                        __m256 pz = _mm256_insertf128_ps(_mm256_castps128_ps256(r2), r6, 1);
+                        __m256 pw = _mm256_insertf128_ps(_mm256_castps128_ps256(r3), r7, 1);
+
+                        __m256 out[4];
+                        for (u32 r{}; r < 4u; ++r) {
+                            out[r] = _mm256_add_ps(
+                                _mm256_add_ps(_mm256_mul_ps(m[0][r], px), _mm256_mul_ps(m[1][r], py)),
+                                _mm256_add_ps(_mm256_mul_ps(m[2][r], pz), _mm256_mul_ps(m[3][r], pw))
+                            );
+                        }
+
+                        __m256 w = out[3];
+                        out[0] = _mm256_div_ps(out[0], w);
+                        out[1] = _mm256_div_ps(out[1], w);
+                        out[2] = _mm256_div_ps(out[2], w);
+                        out[3] = _mm256_div_ps(out[3], w);
+
+                        __m128 o0 = _mm256_castps256_ps128(out[0]);
+                        __m128 o1 = _mm256_castps256_ps128(out[1]);
+                        __m128 o2 = _mm256_castps256_ps128(out[2]);
+                        __m128 o3 = _mm256_castps256_ps128(out[3]);
+                        __m128 o4 = _mm256_extractf128_ps(out[0], 1);
+                        __m128 o5 = _mm256_extractf128_ps(out[1], 1);
+                        __m128 o6 = _mm256_extractf128_ps(out[2], 1);
+                        __m128 o7 = _mm256_extractf128_ps(out[3], 1);
+                        _MM_TRANSPOSE4_PS(o0, o1, o2, o3);
+                        _MM_TRANSPOSE4_PS(o4, o5, o6, o7);
+
+                        _mm_store_ps(&ndc[(i + 0u) * 3u + k].x, o0);
+                        _mm_store_ps(&ndc[(i + 1u) * 3u + k].x, o1);
+                        _mm_store_ps(&ndc[(i + 2u) * 3u + k].x, o2);
+                        _mm_store_ps(&ndc[(i + 3u) * 3u + k].x, o3);
+                        _mm_store_ps(&ndc[(i + 4u) * 3u + k].x, o4);
+                        _mm_store_ps(&ndc[(i + 5u) * 3u + k].x, o5);
+                        _mm_store_ps(&ndc[(i + 6u) * 3u + k].x, o6);
+                        _mm_store_ps(&ndc[(i + 7u) * 3u + k].x, o7);
+                    }
+                }
+            } else if constexpr (Tier == SimdTier::SSE) {
+                __m128 m[4][4];
+                for (u32 c{}; c < 4u; ++c) {
+                    for (u32 r{}; r < 4u; ++r) {
+                        m[c][r] = _mm_set1_ps(transform.m[c][r]);
+                    }
+                }
+
+                for (; i + 4u <= count; i += 4u) {
+                    for (u32 k{}; k < 3u; ++k) {
+                        __m128 r0 = _mm_load_ps(&patches[i + 0u].pos[k].x);
+                        __m128 r1 = _mm_load_ps(&patches[i + 1u].pos[k].x);
+                        __m128 r2 = _mm_load_ps(&patches[i + 2u].pos[k].x);
+                        __m128 r3 = _mm_load_ps(&patches[i + 3u].pos[k].x);
+                        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+                        __m128 out[4];
+                        transform_soa(m, r0, r1, r2, r3, out);
+                        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+
+                        _mm_store_ps(&ndc[(i + 0u) * 3u + k].x, out[0]);
+                        _mm_store_ps(&ndc[(i + 1u) * 3u + k].x, out[1]);
+                        _mm_store_ps(&ndc[(i + 2u) * 3u + k].x, out[2]);
+                        _mm_store_ps(&ndc[(i + 3u) * 3u + k].x, out[3]);
+                    }
+                }
+            }
+
+            for (; i < count; ++i) {
+                for (u32 k{}; k < 3u; ++k) {
+                    vec4 clip = transform * patches[i].pos[k];
+                    ndc[i * 3u + k] = clip / clip.w;
+                }
+            }
+        }
+
+        // rgba_to_u32() with internal linkage for the tails of pack_colors_u32(). Calling the inline original (or the
+        // inline vec4 constructors) would emit weak copies of them into the kernel files built for newer tiers, which the
+        // linker may then pick for every caller.
+        static inline u32 pack_color_u32(const vec4 &rgba) {
+            return ((((u32)(rgba.w * 255.0f) & 0xff) << 24) | ((u32)(rgba.x * 255.0f) & 0xff) << 16) | (((u32)(rgba.y * 255.0f) & 0xff) << 8) | ((u32)(rgba.z * 255.0f) & 0xff);
+        }
+
+        // rgba_to_u32() of `count` colors clamped to [0, 1] like the shaded colors, written to packed[0, count).
+        // AVX-512 uses the 8 wide AVX2 path, the colors are produced 8 at a time anyway.
+        template <SimdTier Tier = SIMD_COMPILED_TIER>
+        inline void pack_colors_u32(const vec4 *colors, usize count, u32 *packed) {
+            usize i{};
+
+            if constexpr (Tier == SimdTier::AVX2 || Tier == SimdTier::AVX512) {
+                const __m256 zero = _mm256_setzero_ps();
+                const __m256 one = _mm256_set1_ps(1.0f);
+                const __m256 scale = _mm256_set1_ps(255.0f);
+
+                for (; i + 8u <= count; i += 8u) {
+                    // AoS -> SoA, two 4x4 transposes
+                    __m128 r0 = _mm_load_ps(&colors[i + 0u].x);
+                    __m128 r1 = _mm_load_ps(&colors[i + 1u].x);
+                    __m128 r2 = _mm_load_ps(&colors[i + 2u].x);
+                    __m128 r3 = _mm_load_ps(&colors[i + 3u].x);
+                    __m128 r4 = _mm_load_ps(&colors[i + 4u].x);
+                    __m128 r5 = _mm_load_ps(&colors[i + 5u].x);
+                    __m128 r6 = _mm_load_ps(&colors[i + 6u].x);
+                    __m128 r7 = _mm_load_ps(&colors[i + 7u].x);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+
+                    __m256 channels[4] = {
+                        _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r4, 1),
+                        _mm256_insertf128_ps(_mm256_castps128_ps256(r1), r5, 1),
+                        _mm256_insertf128_ps(_mm256_castps128_ps256(r2), r6, 1),
+                        _mm256_insertf128_ps(_mm256_castps128_ps256(r3), r7, 1)
+                    };
+
+                    // Same operand order as vec4::max() and vec4::min(), so NaNs saturate the same way
+                    __m256i bytes[4];
+                    for (u32 c{}; c < 4u; ++c) {
+                        bytes[c] = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(channels[c], zero), one), scale));
+                    }
+
+                    __m256i argb = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_slli_epi32(bytes[3], 24), _mm256_slli_epi32(bytes[0], 16)),
+                        _mm256_or_si256(_mm256_slli_epi32(bytes[1], 8), bytes[2])
+                    );
+
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(packed + i), argb);
+                }
+            } else if constexpr (Tier == SimdTier::SSE) {
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 one = _mm_set1_ps(1.0f);
+                const __m128 scale = _mm_set1_ps(255.0f);
+
+                for (; i + 4u <= count; i += 4u) {
+                    __m128 channels[4] = {
+                        _mm_load_ps(&colors[i + 0u].x),
+                        _mm_load_ps(&colors[i + 1u].x),
+                        _mm_load_ps(&colors[i + 2u].x),
+                        _mm_load_ps(&colors[i + 3u].x)
+                    };
+                    _MM_TRANSPOSE4_PS(channels[0], channels[1], channels[2], channels[3]);
+
+                    __m128i bytes[4];
+                    for (u32 c{}; c < 4u; ++c) {
+                        bytes[c] = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(channels[c], zero), one), scale));
+                    }
+
+                    __m128i argb = _mm_or_si128(
+                        _mm_or_si128(_mm_slli_epi32(bytes[3], 24), _mm_slli_epi32(bytes[0], 16)),
+                        _mm_or_si128(_mm_slli_epi32(bytes[1], 8), bytes[2])
+                    );
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(packed + i), argb);
+                }
+            }
+
+            // Constant initialized, vec4::max() and vec4::min() are defined out of line in vec4.cpp
+            static constexpr vec4 ZERO{ 0.0f };
+            static constexpr vec4 ONE{ 1.0f };
+
+            for (; i < count; ++i) {
+                packed[i] = pack_color_u32(colors[i].max(ZERO).min(ONE));
+            }
+        }
+    }
+
+    // One tier's kernels, see get_raster_kernels()
+    struct RasterKernels {
+        SimdTier tier{};
+
+        void (*transform_patches)(const Patch *patches, usize count, const mat4 &transform, vec4 *ndc){};
+        void (*pack_colors)(const vec4 *colors, usize count, u32 *packed){};
+        void (*fill_patch_color)(const RenderTarget &color_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32){};
+        void (*fill_patch_depth)(const RenderTarget &depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 depth32){};
+        void (*fill_patch_color_depth)(const RenderTarget &color_dst, const RenderTarget &depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32, u32 depth32){};
+        void (*fill_patch_color_depth_equal)(const RenderTarget &color_dst, const RenderTarget &depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 color32, u32 depth32){};
+    };
+
+    template <SimdTier Tier>
+    constexpr RasterKernels make_raster_kernels() {
+        return RasterKernels{
+            .tier = Tier,
+            .transform_patches = &detail::transform_patches_ndc<Tier>,
+            .pack_colors = &detail::pack_colors_u32<Tier>,
+            .fill_patch_color = &detail::fill_patch_color<Tier>,
+            .fill_patch_depth = &detail::fill_patch_depth<Tier>,
+            .fill_patch_color_depth = &detail::fill_patch_color_depth<Tier>,
+            .fill_patch_color_depth_equal = &detail::fill_patch_color_depth_equal<Tier>
+        };
+    }
+
+    // Kernels the pipeline uses. With runtime dispatch the best tier that is both built in and supported by the CPU,
+    // selected on the first call, otherwise always the compiled tier.
+    const RasterKernels &get_raster_kernels();
+
+    // Kernels of a specific tier, nullptr if the build does not contain it or the CPU cannot run it
+    const RasterKernels *get_raster_kernels(SimdTier tier);
+
+    namespace detail {
+        // Defined in raster_kernels_avx2.cpp, only part of runtime dispatch builds
+        const RasterKernels &get_avx2_raster_kernels();
+
+        // Defined in raster_kernels_avx512.cpp, part of every SIMD build that does not target AVX-512 as a whole
+        const RasterKernels &get_avx512_raster_kernels();
+    }
+}
+
+#endif
@@ -0,0 +1,13 @@
+// Compiled with AVX2 enabled in runtime dispatch builds, see CMakeLists.txt. Everything else in the build may run on
+// CPUs without it, so this file must not define anything that other files could also instantiate or inline: a weak
+// symbol compiled here (an inline function, a std:: template) can be picked by the linker for every caller. Only the
+// AVX2 instances of the tier templates and internal linkage helpers are allowed.
+#include "raster_kernels.hpp"
+
+#if defined(MATH_SIMD_RUNTIME_DISPATCH)
+static constexpr raster::RasterKernels AVX2_KERNELS = raster::make_raster_kernels<SimdTier::AVX2>();
+
+const raster::RasterKernels &raster::detail::get_avx2_raster_kernels() {
+    return AVX2_KERNELS;
+}
+#endif
@@ -0,0 +1,11 @@
+// Compiled with AVX-512 enabled, see CMakeLists.txt and the rules in raster_kernels_avx2.cpp: nothing but the AVX-512
+// instances of the tier templates may be defined here.
+#include "raster_kernels.hpp"
+
+#if defined(MATH_ENABLE_SIMD) && !defined(MATH_SIMD_AVX512)
+static constexpr raster::RasterKernels AVX512_KERNELS = raster::make_raster_kernels<SimdTier::AVX512>();
+
+const raster::RasterKernels &raster::detail::get_avx512_raster_kernels() {
+    return AVX512_KERNELS;
+}
+#endif
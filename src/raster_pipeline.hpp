@@ -0,0 +1,747 @@
+#ifndef SIMD_EXPERIMENT_RASTER_PIPELINE_HPP
+#define SIMD_EXPERIMENT_RASTER_PIPELINE_HPP
+
+#include <bit>
+#include <span>
+#include <vector>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+
+#include "raster.hpp"
+#include "raster_kernels.hpp"
+#include "arena.hpp"
+
+// Patch setup snaps to 16.8 fixed point
+static constexpr i32 RASTER_SUBPIXEL_BITS = 8;
+static constexpr i32 RASTER_SUBPIXEL_SCALE = 1 << RASTER_SUBPIXEL_BITS;
+
+// Patches with all vertices within this NDC range get the fixed point setup, it keeps the coordinates far below the i32
+// limit for every supported framebuffer size
+static constexpr f32 RASTER_GUARD_BAND = 16.0f;
+
+// Render state known at compile time. Every combination used produces its own fully inlined draw loop.
+struct PipelineState {
+    WindingOrder front_winding = WindingOrder::CCW;
+    bool enable_back_cull = true;
+    bool enable_color = true;
+    bool enable_depth = true;
+    DepthTest depth_test = DepthTest::Less;
+};
+
+// Screen-space result of transforming and culling a single patch
+struct PatchSetup {
+    i32 min_x_i{}, min_y_i{}, max_x_i{}, max_y_i{};
+    vec4 ndc_avg{};
+};
+
+// A patch that already went through setup and shading, only the fill is left
+struct PatchFragment {
+    i32 min_x_i{}, min_y_i{}, max_x_i{}, max_y_i{};
+    u32 color32{};
+    u32 depth32{};
+};
+
+// Upper limit of views a single multi-view draw can render to
+static constexpr u32 RASTER_MAX_VIEWS = 8u;
+
+// View-projection matrices prepared for transforming a vertex against all views at once
+struct MultiviewMatrices {
+    u32 view_count{};
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+    // Columns of two views per register, the lower half is the even view
+    __m256 columns[RASTER_MAX_VIEWS / 2u][4]{};
+#else
+    mat4 matrices[RASTER_MAX_VIEWS]{};
+#endif
+};
+
+namespace raster {
+    // Wraps a free function into an empty callable, so that it gets inlined into the pipeline instead of being called indirectly
+    template <auto Fn>
+    inline constexpr auto static_shader = [](const auto &...args) { return Fn(args...); };
+
+    // Placeholder for pipelines that never shade, e.g. depth-only passes. Also takes the extra arguments of the instanced
+    // and multi-view draws.
+    inline constexpr auto null_patch_shader = [](const Patch &patch, const vec4 &avg_ndc, const auto &...) { return vec4(0.0f); };
+
+    // Patch shader for unlit meshes, create it with prepacked_color_shader(). The pipeline reads the colors the mesh packed
+    // in mark_modified() instead of calling a shader and packing its result, the output is the same as returning
+    // vec4(patch.color, 1.0f). Only valid for the patches of the mesh it was created for.
+    struct PrepackedColorShader {
+        const Patch *patches{};
+        const u32 *colors32{};
+
+        inline u32 color32(const Patch &patch) const {
+            return colors32[&patch - patches];
+        }
+    };
+
+    inline PrepackedColorShader prepacked_color_shader(const Mesh &mesh) {
+        assert(mesh.colors32.size() == mesh.patches.size() && "The mesh's colors are stale, call mark_modified()!");
+        return PrepackedColorShader{ mesh.patches.data(), mesh.colors32.data() };
+    }
+
+    namespace detail {
+        // Early-Z for the Equal test: a patch that lost every pixel in the prepass is not shaded at all
+        inline bool any_depth_equal(const RenderTarget &depth_dst, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, u32 depth32) {
+            u32 width = depth_dst.width;
+
+            for (i32 y = min_y_i; y < max_y_i; ++y) {
+                const u32 *row = depth_dst.data + y * width;
+
+                for (i32 x = min_x_i; x < max_x_i; ++x) {
+                    if (row[x] == depth32) {
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        inline WindingOrder get_winding_order(const vec4 &ndc0, const vec4 &ndc1, const vec4 &ndc2) {
+            /// Determinant of such matrix:
+            // | ndc0.x ndc0.y 1.0 |
+            // | ndc1.x ndc1.y 1.0 |
+            // | ndc2.x ndc2.y 1.0 |
+
+            return ((
+                ndc0.x * ndc1.y + ndc0.y * ndc2.x + ndc1.x * ndc2.y - ndc1.y * ndc2.x - ndc0.y * ndc1.x - ndc0.x * ndc2.y
+            ) < 0.0f) ? WindingOrder::CW : WindingOrder::CCW;
+        }
+
+        // Screen position in 16.8 fixed point, rounded to nearest like the hardware does, so the snapping does not depend
+        // on the compiler's choice of float instructions
+        inline i32 snap_to_fixed(f32 ndc, f32 size) {
+            f32 fixed = (ndc * 0.5f + 0.5f) * size * static_cast<f32>(RASTER_SUBPIXEL_SCALE);
+
+#ifdef MATH_ENABLE_SIMD
+            return _mm_cvtss_si32(_mm_set_ss(fixed));
+#else
+            return static_cast<i32>(std::lrint(fixed));
+#endif
+        }
+
+        // Index range of the pixel centers lying within [min_fx, max_fx], empty if the range falls between two centers
+        inline i32 first_pixel_center(i32 min_fx) {
+            return (min_fx - RASTER_SUBPIXEL_SCALE / 2 + RASTER_SUBPIXEL_SCALE - 1) >> RASTER_SUBPIXEL_BITS;
+        }
+        inline i32 last_pixel_center(i32 max_fx) {
+            return (max_fx - RASTER_SUBPIXEL_SCALE / 2) >> RASTER_SUBPIXEL_BITS;
+        }
+
+        // Culls and bounds an already transformed patch
+        template <PipelineState State>
+        inline bool setup_patch_ndc(const vec4 &v0_ndc, const vec4 &v1_ndc, const vec4 &v2_ndc, u32 width, u32 height, PatchSetup &setup) {
+            f32 min_x = std::min(v0_ndc.x, std::min(v1_ndc.x, v2_ndc.x));
+            f32 min_y = std::min(v0_ndc.y, std::min(v1_ndc.y, v2_ndc.y));
+            f32 min_z = std::min(v0_ndc.z, std::min(v1_ndc.z, v2_ndc.z));
+            f32 max_x = std::max(v0_ndc.x, std::max(v1_ndc.x, v2_ndc.x));
+            f32 max_y = std::max(v0_ndc.y, std::max(v1_ndc.y, v2_ndc.y));
+            f32 max_z = std::max(v0_ndc.z, std::max(v1_ndc.z, v2_ndc.z));
+
+            if (max_x <= -1.0f || min_x >= 1.0f || max_y <= -1.0f || min_y >= 1.0f || min_z <= 0.0f || max_z >= 1.0f) {
+                return false;
+            }
+
+            const f32 width_f = static_cast<f32>(width);
+            const f32 height_f = static_cast<f32>(height);
+
+            if (min_x >= -RASTER_GUARD_BAND && max_x <= RASTER_GUARD_BAND && min_y >= -RASTER_GUARD_BAND && max_y <= RASTER_GUARD_BAND) {
+                i32 x0 = snap_to_fixed(v0_ndc.x, width_f), y0 = snap_to_fixed(v0_ndc.y, height_f);
+                i32 x1 = snap_to_fixed(v1_ndc.x, width_f), y1 = snap_to_fixed(v1_ndc.y, height_f);
+                i32 x2 = snap_to_fixed(v2_ndc.x, width_f), y2 = snap_to_fixed(v2_ndc.y, height_f);
+
+                // Twice the signed area, exact in 64 bits. Same sign convention as get_winding_order().
+                i64 area2 = static_cast<i64>(x1 - x0) * static_cast<i64>(y2 - y0) - static_cast<i64>(x2 - x0) * static_cast<i64>(y1 - y0);
+
+                if (area2 == 0) {
+                    return false;
+                }
+
+                if constexpr (State.enable_back_cull) {
+                    if ((area2 < 0 ? WindingOrder::CW : WindingOrder::CCW) != State.front_winding) {
+                        return false;
+                    }
+                }
+
+                i32 min_x_fx = std::min(x0, std::min(x1, x2));
+                i32 min_y_fx = std::min(y0, std::min(y1, y2));
+                i32 max_x_fx = std::max(x0, std::max(x1, x2));
+                i32 max_y_fx = std::max(y0, std::max(y1, y2));
+
+                // A patch that contains no pixel center adds nothing to a closed mesh, its neighbours cover the same pixels
+                if (first_pixel_center(min_x_fx) > last_pixel_center(max_x_fx) || first_pixel_center(min_y_fx) > last_pixel_center(max_y_fx)) {
+                    return false;
+                }
+
+                // Conservative bounds: every pixel the patch touches
+                setup.min_x_i = std::max(min_x_fx >> RASTER_SUBPIXEL_BITS, 0);
+                setup.min_y_i = std::max(min_y_fx >> RASTER_SUBPIXEL_BITS, 0);
+                setup.max_x_i = std::min((max_x_fx + RASTER_SUBPIXEL_SCALE - 1) >> RASTER_SUBPIXEL_BITS, static_cast<i32>(width));
+                setup.max_y_i = std::min((max_y_fx + RASTER_SUBPIXEL_SCALE - 1) >> RASTER_SUBPIXEL_BITS, static_cast<i32>(height));
+            } else {
+                // Huge patches reaching far outside of the screen would overflow the fixed point range
+                if constexpr (State.enable_back_cull) {
+                    if (get_winding_order(v0_ndc, v1_ndc, v2_ndc) != State.front_winding) {
+                        return false;
+                    }
+                }
+
+                setup.min_x_i = std::max(static_cast<i32>(std::floor((std::max(min_x, -1.0f) * 0.5f + 0.5f) * width_f)), 0);
+                setup.min_y_i = std::max(static_cast<i32>(std::floor((std::max(min_y, -1.0f) * 0.5f + 0.5f) * height_f)), 0);
+                setup.max_x_i = std::min(static_cast<i32>(std::ceil((std::min(max_x, 1.0f) * 0.5f + 0.5f) * width_f)), static_cast<i32>(width));
+                setup.max_y_i = std::min(static_cast<i32>(std::ceil((std::min(max_y, 1.0f) * 0.5f + 0.5f) * height_f)), static_cast<i32>(height));
+            }
+
+            // Depth-only pipelines never shade, only the depth is needed
+            if constexpr (State.enable_color) {
+                setup.ndc_avg = (v0_ndc + v1_ndc + v2_ndc) / 3.0f;
+            } else {
+                setup.ndc_avg.z = (v0_ndc.z + v1_ndc.z + v2_ndc.z) / 3.0f;
+            }
+
+            return true;
+        }
+
+        template <PipelineState State, typename VertexShader>
+        inline bool setup_patch(const Patch &patch, const VertexShader &vertex_shader, u32 width, u32 height, PatchSetup &setup) {
+            return setup_patch_ndc<State>(vertex_shader(patch.pos[0]), vertex_shader(patch.pos[1]), vertex_shader(patch.pos[2]), width, height, setup);
+        }
+
+        // Splits the rect into the parts lying in the tiles set in the mask. Horizontal runs of set tiles are merged.
+        template <typename Fill>
+        inline void for_each_masked_rect(const TileMask &mask, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i, const Fill &fill) {
+            if (min_x_i >= max_x_i || min_y_i >= max_y_i) {
+                return;
+            }
+
+            constexpr i32 tile_size = static_cast<i32>(RASTER_TILE_SIZE);
+
+            u32 min_tile_x = static_cast<u32>(min_x_i / tile_size);
+            u32 max_tile_x = static_cast<u32>((max_x_i - 1) / tile_size);
+            u64 span_bits = TileMask::row_bits(min_tile_x, max_tile_x);
+
+            for (i32 ty = min_y_i / tile_size; ty <= (max_y_i - 1) / tile_size; ++ty) {
+                u64 row = mask.rows[ty] & span_bits;
+
+                i32 y0 = std::max(min_y_i, ty * tile_size);
+                i32 y1 = std::min(max_y_i, (ty + 1) * tile_size);
+
+                while (row != 0ull) {
+                    i32 run_start = std::countr_zero(row);
+                    i32 run_end = run_start + std::countr_one(row >> run_start);
+
+                    fill(std::max(min_x_i, run_start * tile_size), y0, std::min(max_x_i, run_end * tile_size), y1);
+
+                    row &= ~TileMask::row_bits(static_cast<u32>(run_start), static_cast<u32>(run_end - 1));
+                }
+            }
+        }
+    }
+
+    namespace detail {
+        template <PipelineState State>
+        inline void splat_pixel(const PatchFragment &fragment, const RenderTarget &color_buffer, const RenderTarget &depth_buffer, u32 idx) {
+            if constexpr (State.enable_color && State.enable_depth && State.depth_test == DepthTest::Equal) {
+                if (depth_buffer.data[idx] == fragment.depth32) {
+                    color_buffer.data[idx] = fragment.color32;
+                }
+            } else if constexpr (State.enable_color && State.enable_depth) {
+                if (fragment.depth32 < depth_buffer.data[idx]) {
+                    depth_buffer.data[idx] = fragment.depth32;
+                    color_buffer.data[idx] = fragment.color32;
+                }
+            } else if constexpr (State.enable_color) {
+                color_buffer.data[idx] = fragment.color32;
+            } else {
+                depth_buffer.data[idx] = std::min(depth_buffer.data[idx], fragment.depth32);
+            }
+        }
+
+        // Distant and dense geometry is mostly patches of 1 to 4 pixels, for those the span setup of the fill loops
+        // (tail masks, row loops) costs more than the pixels themselves, so they are written directly
+        template <PipelineState State>
+        inline void splat_tiny_fragment(const PatchFragment &fragment, const RenderTarget &color_buffer, const RenderTarget &depth_buffer, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i) {
+            u32 width = State.enable_color ? color_buffer.width : depth_buffer.width;
+            u32 idx = min_y_i * width + min_x_i;
+
+            bool wide = max_x_i - min_x_i == 2;
+            bool tall = max_y_i - min_y_i == 2;
+
+            splat_pixel<State>(fragment, color_buffer, depth_buffer, idx);
+            if (wide) {
+                splat_pixel<State>(fragment, color_buffer, depth_buffer, idx + 1u);
+            }
+            if (tall) {
+                splat_pixel<State>(fragment, color_buffer, depth_buffer, idx + width);
+
+                if (wide) {
+                    splat_pixel<State>(fragment, color_buffer, depth_buffer, idx + width + 1u);
+                }
+            }
+        }
+
+        template <PipelineState State>
+        inline void fill_fragment(const PatchFragment &fragment, const RenderTarget &color_buffer, const RenderTarget &depth_buffer, i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i) {
+            i32 size_x = max_x_i - min_x_i;
+            i32 size_y = max_y_i - min_y_i;
+
+            if (size_x > 0 && size_x <= 2 && size_y > 0 && size_y <= 2) {
+                splat_tiny_fragment<State>(fragment, color_buffer, depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i);
+                return;
+            }
+
+#if defined(MATH_SIMD_RUNTIME_DISPATCH)
+            const RasterKernels &kernels = get_raster_kernels();
+
+            if constexpr (State.enable_color && State.enable_depth && State.depth_test == DepthTest::Equal) {
+                kernels.fill_patch_color_depth_equal(color_buffer, depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.color32, fragment.depth32);
+            } else if constexpr (State.enable_color && State.enable_depth) {
+                kernels.fill_patch_color_depth(color_buffer, depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.color32, fragment.depth32);
+            } else if constexpr (State.enable_color) {
+                kernels.fill_patch_color(color_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.color32);
+            } else {
+                kernels.fill_patch_depth(depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.depth32);
+            }
+#else
+            if constexpr (State.enable_color && State.enable_depth && State.depth_test == DepthTest::Equal) {
+                fill_patch_color_depth_equal(color_buffer, depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.color32, fragment.depth32);
+            } else if constexpr (State.enable_color && State.enable_depth) {
+                fill_patch_color_depth(color_buffer, depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.color32, fragment.depth32);
+            } else if constexpr (State.enable_color) {
+                fill_patch_color(color_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.color32);
+            } else {
+                fill_patch_depth(depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i, fragment.depth32);
+            }
+#endif
+        }
+
+        template <PipelineState State>
+        inline void get_target_size(const RenderTarget &color_buffer, const RenderTarget &depth_buffer, u32 &width, u32 &height) {
+            static_assert(State.enable_color || State.enable_depth, "A pipeline has to write to at least one buffer!");
+            static_assert(State.depth_test != DepthTest::Equal || (State.enable_color && State.enable_depth), "The Equal depth test needs both a color and a depth buffer!");
+
+            if constexpr (State.enable_color) {
+                assert(color_buffer.valid());
+                width = color_buffer.width;
+                height = color_buffer.height;
+            } else {
+                assert(depth_buffer.valid());
+                width = depth_buffer.width;
+                height = depth_buffer.height;
+            }
+
+            if constexpr (State.enable_color && State.enable_depth) {
+                assert(color_buffer.width == depth_buffer.width);
+                assert(color_buffer.height == depth_buffer.height);
+            }
+        }
+
+        // Holds back shaded fragments until 8 of them are shaded, so that their colors are packed together by the pack
+        // kernel. The fragments are passed on to `emit` in the order they were shaded, call flush() after the last one.
+        template <typename Emit>
+        class ColorPackBatch {
+        public:
+            static constexpr u32 SIZE = 8u;
+
+            explicit ColorPackBatch(const Emit &emit) : _emit(emit) {}
+
+            inline void push(const PatchFragment &fragment, const vec4 &color) {
+                _fragments[_count] = fragment;
+                _colors[_count] = color;
+
+                if (++_count == SIZE) {
+                    flush();
+                }
+            }
+
+            // Fragments that are already packed, or have no color, keep their place in the order
+            inline void operator()(const PatchFragment &fragment) {
+                flush();
+                _emit(fragment);
+            }
+
+            inline void flush() {
+                if (_count == 0u) {
+                    return;
+                }
+
+                u32 packed[SIZE];
+                pack_colors(std::span<const vec4>(_colors, _count), packed);
+
+                for (u32 i{}; i < _count; ++i) {
+                    _fragments[i].color32 = packed[i];
+                    _emit(_fragments[i]);
+                }
+
+                _count = 0u;
+            }
+
+        private:
+            const Emit &_emit;
+
+            PatchFragment _fragments[SIZE]{};
+            vec4 _colors[SIZE]{};
+            u32 _count{};
+        };
+
+        // `early_test` sees the fragment before shading, patches it rejects are skipped. A ColorPackBatch as `emit` packs
+        // the colors in batches, anything else gets every fragment with its color already packed.
+        template <PipelineState State, typename PatchShader, typename EarlyTest, typename Emit>
+        inline void shade_patch(const Patch &patch, const PatchSetup &setup, const PatchShader &patch_shader, const EarlyTest &early_test, Emit &&emit) {
+            constexpr const f32 max_depth_f = static_cast<f32>(UINT32_MAX);
+
+            PatchFragment fragment{
+                .min_x_i = setup.min_x_i,
+                .min_y_i = setup.min_y_i,
+                .max_x_i = setup.max_x_i,
+                .max_y_i = setup.max_y_i,
+                .depth32 = static_cast<u32>(setup.ndc_avg.z * max_depth_f)
+            };
+
+            if (!early_test(fragment)) {
+                return;
+            }
+
+            if constexpr (State.enable_color && std::is_same_v<PatchShader, PrepackedColorShader>) {
+                fragment.color32 = patch_shader.color32(patch);
+            } else if constexpr (State.enable_color) {
+                vec4 color = patch_shader(patch, setup.ndc_avg);
+
+                if constexpr (requires { emit.push(fragment, color); }) {
+                    emit.push(fragment, color);
+                    return;
+                } else {
+                    fragment.color32 = rgba_to_u32(color.max(0.0f).min(1.0f));
+                }
+            }
+
+            emit(fragment);
+        }
+
+        // Equal pipelines are the color half of a Z-prepass and walk the patches last to first: of several patches at a
+        // pixel's depth the first one is written last and stays on top, the same one a single Less pass keeps
+        template <PipelineState State, typename VertexShader, typename PatchShader, typename EarlyTest, typename Emit>
+        inline void process_patches(std::span<const Patch> patches, const VertexShader &vertex_shader, const PatchShader &patch_shader, u32 width, u32 height, const EarlyTest &early_test, const Emit &emit) {
+            ColorPackBatch<Emit> batch(emit);
+
+            PatchSetup setup{};
+            auto process_patch = [&](const Patch &patch) {
+                if (setup_patch<State>(patch, vertex_shader, width, height, setup)) {
+                    shade_patch<State>(patch, setup, patch_shader, early_test, batch);
+                }
+            };
+
+            if constexpr (State.depth_test == DepthTest::Equal) {
+                for (usize i = patches.size(); i > 0u; --i) {
+                    process_patch(patches[i - 1u]);
+                }
+            } else {
+                for (const auto &patch : patches) {
+                    process_patch(patch);
+                }
+            }
+
+            batch.flush();
+        }
+
+        // Instances outside of the view are culled by the mesh bounds, the rest is transformed in one batch each.
+        // The patch shader additionally receives the instance's model matrix and the patch's normal transformed by it,
+        // which are also transformed in one batch per range of patches.
+        template <PipelineState State, typename PatchShader, typename EarlyTest, typename Emit>
+        inline void process_instances(const Mesh &mesh, std::span<const mat4> instance_transforms, const mat4 &view_proj, const PatchShader &patch_shader, u32 width, u32 height, const EarlyTest &early_test, const Emit &emit) {
+            static_assert(State.depth_test != DepthTest::Equal, "Only process_patches() draws in the order Equal pipelines need!");
+
+            // Depth-only pipelines never shade, prepacked colors don't need the normals
+            constexpr bool NEEDS_NORMALS = State.enable_color && !std::is_same_v<PatchShader, PrepackedColorShader>;
+
+            // Scratch for the largest possible range, from the calling thread's frame arena and released on return
+            Arena &scratch = get_frame_arena().local();
+            ArenaScope scratch_scope(scratch);
+
+            std::span<vec4> ndc = scratch.allocate_array<vec4>(mesh.patches.size() * 3u);
+            std::span<vec3> normals = scratch.allocate_array<vec3>(NEEDS_NORMALS ? mesh.patches.size() : 0u);
+
+            ColorPackBatch<Emit> batch(emit);
+
+            PatchSetup setup{};
+            for (const mat4 &model : instance_transforms) {
+                mat4 model_view_proj = view_proj * model;
+
+                if (!is_bounds_visible(mesh.bounds, model_view_proj)) {
+                    continue;
+                }
+
+                mat4 normal_matrix = get_normal_matrix(model);
+
+                auto process_range = [&](std::span<const Patch> patches) {
+                    transform_patches(patches, model_view_proj, ndc);
+
+                    if constexpr (NEEDS_NORMALS) {
+                        transform_normals(patches, normal_matrix, normals);
+                    }
+
+                    for (usize i{}; i < patches.size(); ++i) {
+                        if (!setup_patch_ndc<State>(ndc[i * 3u], ndc[i * 3u + 1u], ndc[i * 3u + 2u], width, height, setup)) {
+                            continue;
+                        }
+
+                        if constexpr (std::is_same_v<PatchShader, PrepackedColorShader>) {
+                            shade_patch<State>(patches[i], setup, patch_shader, early_test, batch);
+                        } else {
+                            auto instance_shader = [&](const Patch &patch, const vec4 &avg_ndc) {
+                                return patch_shader(patch, avg_ndc, model, normals[i]);
+                            };
+
+                            shade_patch<State>(patches[i], setup, instance_shader, early_test, batch);
+                        }
+                    }
+                };
+
+                if (mesh.meshlets.empty()) {
+                    process_range(mesh.patches);
+                    continue;
+                }
+
+                // Runs of visible meshlets are transformed together
+                MeshletCuller culler = make_meshlet_culler(model_view_proj, State.front_winding, State.enable_back_cull);
+                std::span<const Patch> patches = mesh.patches;
+
+                u32 run_first{};
+                u32 run_count{};
+                for (const Meshlet &meshlet : mesh.meshlets) {
+                    if (!is_meshlet_visible(meshlet, culler)) {
+                        continue;
+                    }
+
+                    if (run_count > 0u && run_first + run_count != meshlet.first) {
+                        process_range(patches.subspan(run_first, run_count));
+                        run_count = 0u;
+                    }
+                    if (run_count == 0u) {
+                        run_first = meshlet.first;
+                    }
+                    run_count += meshlet.count;
+                }
+
+                if (run_count > 0u) {
+                    process_range(patches.subspan(run_first, run_count));
+                }
+            }
+
+            batch.flush();
+        }
+
+        inline void pack_view_matrices(std::span<const mat4> view_projs, MultiviewMatrices &packed) {
+            assert(view_projs.size() <= RASTER_MAX_VIEWS);
+
+            packed.view_count = static_cast<u32>(view_projs.size());
+
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+            for (u32 pair{}; pair * 2u < packed.view_count; ++pair) {
+                // An odd view count transforms the last view twice and ignores the second result
+                const mat4 &lo = view_projs[pair * 2u];
+                const mat4 &hi = view_projs[std::min(pair * 2u + 1u, packed.view_count - 1u)];
+
+                for (u32 c{}; c < 4u; ++c) {
+                    packed.columns[pair][c] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(lo.m[c])), _mm_load_ps(hi.m[c]), 1);
+                }
+            }
+#else
+            for (u32 view{}; view < packed.view_count; ++view) {
+                packed.matrices[view] = view_projs[view];
+            }
+#endif
+        }
+
+        // NDC position of the vertex in every view, same results as (view_proj * v_in) / w
+        inline void transform_multiview(const vec4 &v_in, const MultiviewMatrices &packed, vec4 *ndc) {
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+            const __m256 x = _mm256_set1_ps(v_in.x);
+            const __m256 y = _mm256_set1_ps(v_in.y);
+            const __m256 z = _mm256_set1_ps(v_in.z);
+            const __m256 w = _mm256_set1_ps(v_in.w);
+
+            for (u32 pair{}; pair * 2u < packed.view_count; ++pair) {
+                const __m256 *columns = packed.columns[pair];
+
+                // Summed in the same order as mat4 * vec4
+                __m256 clip = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(columns[2], z), _mm256_mul_ps(columns[3], w)),
+                    _mm256_add_ps(_mm256_mul_ps(columns[0], x), _mm256_mul_ps(columns[1], y))
+                );
+                __m256 result = _mm256_div_ps(clip, _mm256_permute_ps(clip, 0b11111111));
+
+                _mm_store_ps(&ndc[pair * 2u].x, _mm256_castps256_ps128(result));
+                if (pair * 2u + 1u < packed.view_count) {
+                    _mm_store_ps(&ndc[pair * 2u + 1u].x, _mm256_extractf128_ps(result, 1));
+                }
+            }
+#else
+            for (u32 view{}; view < packed.view_count; ++view) {
+                vec4 clip = packed.matrices[view] * v_in;
+                ndc[view] = clip / clip.w;
+            }
+#endif
+        }
+
+        template <PipelineState State>
+        inline auto make_early_test(const RenderTarget &depth_buffer) {
+            return [&](const PatchFragment &fragment) {
+                if constexpr (State.depth_test == DepthTest::Equal) {
+                    return any_depth_equal(depth_buffer, fragment.min_x_i, fragment.min_y_i, fragment.max_x_i, fragment.max_y_i, fragment.depth32);
+                } else {
+                    return true;
+                }
+            };
+        }
+
+        // The depth buffer is only filled on replay, so captures have nothing to test against yet
+        inline constexpr auto no_early_test = [](const PatchFragment &fragment) { return true; };
+    }
+
+    template <PipelineState State, typename VertexShader, typename PatchShader>
+    void draw_patches(std::span<const Patch> patches, const VertexShader &vertex_shader, const PatchShader &patch_shader, const RenderTarget &color_buffer, const RenderTarget &depth_buffer) {
+        u32 width{}, height{};
+        detail::get_target_size<State>(color_buffer, depth_buffer, width, height);
+
+        detail::process_patches<State>(patches, vertex_shader, patch_shader, width, height, detail::make_early_test<State>(depth_buffer), [&](const PatchFragment &fragment) {
+            detail::fill_fragment<State>(fragment, color_buffer, depth_buffer, fragment.min_x_i, fragment.min_y_i, fragment.max_x_i, fragment.max_y_i);
+        });
+    }
+
+    // Draws every instance of the mesh with its own model matrix. The patch shader is called as
+    // patch_shader(patch, avg_ndc, model, normal), so nothing per instance has to go through global state. `normal` is
+    // the patch's normal transformed by get_normal_matrix(model) and normalized.
+    template <PipelineState State, typename PatchShader>
+    void draw_instanced(const Mesh &mesh, std::span<const mat4> instance_transforms, const mat4 &view_proj, const PatchShader &patch_shader, const RenderTarget &color_buffer, const RenderTarget &depth_buffer) {
+        u32 width{}, height{};
+        detail::get_target_size<State>(color_buffer, depth_buffer, width, height);
+
+        detail::process_instances<State>(mesh, instance_transforms, view_proj, patch_shader, width, height, detail::make_early_test<State>(depth_buffer), [&](const PatchFragment &fragment) {
+            detail::fill_fragment<State>(fragment, color_buffer, depth_buffer, fragment.min_x_i, fragment.min_y_i, fragment.max_x_i, fragment.max_y_i);
+        });
+    }
+
+    // Draws a single object placed by its model matrix, which may also rotate and scale it, without rewriting its patches.
+    // Same as draw_instanced() with one instance.
+    template <PipelineState State, typename PatchShader>
+    void draw_model(const Mesh &mesh, const mat4 &model, const mat4 &view_proj, const PatchShader &patch_shader, const RenderTarget &color_buffer, const RenderTarget &depth_buffer) {
+        draw_instanced<State>(mesh, std::span<const mat4>(&model, 1u), view_proj, patch_shader, color_buffer, depth_buffer);
+    }
+
+    // Renders the patches from several views in one walk over them. Every vertex is transformed against all view-projection
+    // matrices at once, and every view has its own targets, which may differ in size. The patch shader is called as
+    // patch_shader(patch, avg_ndc, view) for every view the patch is visible in.
+    template <PipelineState State, typename PatchShader>
+    void draw_patches_multiview(std::span<const Patch> patches, std::span<const mat4> view_projs, const PatchShader &patch_shader, std::span<const RenderTarget> color_buffers, std::span<const RenderTarget> depth_buffers) {
+        static_assert(State.depth_test != DepthTest::Equal, "Only process_patches() draws in the order Equal pipelines need!");
+        assert(!State.enable_color || color_buffers.size() >= view_projs.size());
+        assert(!State.enable_depth || depth_buffers.size() >= view_projs.size());
+
+        const u32 view_count = static_cast<u32>(view_projs.size());
+
+        u32 widths[RASTER_MAX_VIEWS]{}, heights[RASTER_MAX_VIEWS]{};
+        for (u32 view{}; view < view_count; ++view) {
+            detail::get_target_size<State>(
+                State.enable_color ? color_buffers[view] : RenderTarget{},
+                State.enable_depth ? depth_buffers[view] : RenderTarget{},
+                widths[view], heights[view]
+            );
+        }
+
+        MultiviewMatrices packed{};
+        detail::pack_view_matrices(view_projs, packed);
+
+        vec4 ndc[3][RASTER_MAX_VIEWS]{};
+
+        PatchSetup setup{};
+        for (const auto &patch : patches) {
+            detail::transform_multiview(patch.pos[0], packed, ndc[0]);
+            detail::transform_multiview(patch.pos[1], packed, ndc[1]);
+            detail::transform_multiview(patch.pos[2], packed, ndc[2]);
+
+            for (u32 view{}; view < view_count; ++view) {
+                if (!detail::setup_patch_ndc<State>(ndc[0][view], ndc[1][view], ndc[2][view], widths[view], heights[view], setup)) {
+                    continue;
+                }
+
+                const RenderTarget color_buffer = State.enable_color ? color_buffers[view] : RenderTarget{};
+                const RenderTarget depth_buffer = State.enable_depth ? depth_buffers[view] : RenderTarget{};
+
+                auto view_shader = [&](const Patch &p, const vec4 &avg_ndc) {
+                    return patch_shader(p, avg_ndc, view);
+                };
+
+                detail::shade_patch<State>(patch, setup, view_shader, detail::make_early_test<State>(depth_buffer), [&](const PatchFragment &fragment) {
+                    detail::fill_fragment<State>(fragment, color_buffer, depth_buffer, fragment.min_x_i, fragment.min_y_i, fragment.max_x_i, fragment.max_y_i);
+                });
+            }
+        }
+    }
+
+    // Z-prepass: depth first without any shading, then color with an Equal depth test. Transforms every patch twice,
+    // but shades only the patches that are visible somewhere. Gives the same image as a single Less pass, also where
+    // patches end up at the same depth.
+    template <PipelineState State, typename VertexShader, typename PatchShader>
+    void draw_patches_z_prepass(std::span<const Patch> patches, const VertexShader &vertex_shader, const PatchShader &patch_shader, const RenderTarget &color_buffer, const RenderTarget &depth_buffer) {
+        static_assert(State.enable_color && State.enable_depth, "A Z-prepass needs both a color and a depth buffer!");
+
+        constexpr PipelineState depth_state{
+            .front_winding = State.front_winding,
+            .enable_back_cull = State.enable_back_cull,
+            .enable_color = false,
+            .enable_depth = true
+        };
+        constexpr PipelineState color_state{
+            .front_winding = State.front_winding,
+            .enable_back_cull = State.enable_back_cull,
+            .enable_color = true,
+            .enable_depth = true,
+            .depth_test = DepthTest::Equal
+        };
+
+        draw_patches<depth_state>(patches, vertex_shader, null_patch_shader, RenderTarget{}, depth_buffer);
+        draw_patches<color_state>(patches, vertex_shader, patch_shader, color_buffer, depth_buffer);
+    }
+
+    // Runs setup and shading only, the fragments can be filled later (and repeatedly) with draw_fragments()
+    template <PipelineState State, typename VertexShader, typename PatchShader>
+    void capture_fragments(std::span<const Patch> patches, const VertexShader &vertex_shader, const PatchShader &patch_shader, u32 width, u32 height, std::vector<PatchFragment> &fragments) {
+        detail::process_patches<State>(patches, vertex_shader, patch_shader, width, height, detail::no_early_test, [&](const PatchFragment &fragment) {
+            fragments.push_back(fragment);
+        });
+    }
+
+    // Instanced version of capture_fragments(), see draw_instanced()
+    template <PipelineState State, typename PatchShader>
+    void capture_instanced(const Mesh &mesh, std::span<const mat4> instance_transforms, const mat4 &view_proj, const PatchShader &patch_shader, u32 width, u32 height, std::vector<PatchFragment> &fragments) {
+        detail::process_instances<State>(mesh, instance_transforms, view_proj, patch_shader, width, height, detail::no_early_test, [&](const PatchFragment &fragment) {
+            fragments.push_back(fragment);
+        });
+    }
+
+    // Fills previously captured fragments, optionally only in the tiles set in the mask
+    template <PipelineState State>
+    void draw_fragments(std::span<const PatchFragment> fragments, const RenderTarget &color_buffer, const RenderTarget &depth_buffer, const TileMask *tile_mask = nullptr) {
+        u32 width{}, height{};
+        detail::get_target_size<State>(color_buffer, depth_buffer, width, height);
+
+        if (tile_mask == nullptr) {
+            for (const auto &fragment : fragments) {
+                detail::fill_fragment<State>(fragment, color_buffer, depth_buffer, fragment.min_x_i, fragment.min_y_i, fragment.max_x_i, fragment.max_y_i);
+            }
+        } else {
+            for (const auto &fragment : fragments) {
+                detail::for_each_masked_rect(*tile_mask, fragment.min_x_i, fragment.min_y_i, fragment.max_x_i, fragment.max_y_i, [&](i32 min_x_i, i32 min_y_i, i32 max_x_i, i32 max_y_i) {
+                    detail::fill_fragment<State>(fragment, color_buffer, depth_buffer, min_x_i, min_y_i, max_x_i, max_y_i);
+                });
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include <cassert>
+#include <algorithm>
+
+#include "retained_frame.hpp"
+#include "worker_pool.hpp"
+
+RetainedFrame::RetainedFrame(const RenderTarget &color_buffer, const RenderTarget &depth_buffer, u32 clear_color, u32 clear_depth, u32 fill_thread_count)
+    : _color_buffer(color_buffer), _depth_buffer(depth_buffer), _clear_color(clear_color), _clear_depth(clear_depth), _fill_thread_count(fill_thread_count) {
+    assert(color_buffer.valid() || depth_buffer.valid());
+    assert(fill_thread_count >= 1u);
+}
+
+void RetainedFrame::begin(u64 view_hash) {
+    _view_hash = view_hash;
+    _draws.clear();
+    _captures.reset();
+}
+
+bool RetainedFrame::end() {
+    u32 width = target_width();
+    u32 height = target_height();
+
+    bool full_redraw = !_valid || _view_hash != _last_view_hash || width != _last_width || height != _last_height;
+
+    _last_view_hash = _view_hash;
+    _last_width = width;
+    _last_height = height;
+    _valid = true;
+
+    _dirty_tiles.clear();
+
+    if (full_redraw) {
+        _dirty_tiles.set_all(width, height);
+    }
+
+    // A draw that changed or disappeared dirties the tiles it used to cover and the ones it covers now
+    for (usize i = _draws.size(); i < _history.size(); ++i) {
+        _dirty_tiles |= _history[i].coverage;
+    }
+
+    _history.resize(_draws.size());
+
+    for (usize i{}; i < _draws.size(); ++i) {
+        DrawHistory &history = _history[i];
+
+        if (!full_redraw && history.hash == _draws[i].hash) {
+            continue;
+        }
+
+        _dirty_tiles |= history.coverage;
+
+        history.hash = _draws[i].hash;
+        history.fragments.clear();
+        _draws[i].capture_fn(_draws[i].capture, history.fragments);
+
+        history.coverage.clear();
+        for (const PatchFragment &fragment : history.fragments) {
+            history.coverage.set_pixel_rect(fragment.min_x_i, fragment.min_y_i, fragment.max_x_i, fragment.max_y_i);
+        }
+
+        _dirty_tiles |= history.coverage;
+    }
+
+    if (!_dirty_tiles.any()) {
+        return false;
+    }
+
+    ++_content_version;
+
+    u32 tile_rows = (height + RASTER_TILE_SIZE - 1u) / RASTER_TILE_SIZE;
+    u32 band_count = std::min(_fill_thread_count, tile_rows);
+
+    if (band_count <= 1u) {
+        if (full_redraw) {
+            if (_color_buffer.valid()) {
+                _color_buffer.fill(_clear_color);
+            }
+            if (_depth_buffer.valid()) {
+                _depth_buffer.fill(_clear_depth);
+            }
+        } else {
+            if (_color_buffer.valid()) {
+                _color_buffer.fill_tiles(_dirty_tiles, _clear_color);
+            }
+            if (_depth_buffer.valid()) {
+                _depth_buffer.fill_tiles(_dirty_tiles, _clear_depth);
+            }
+        }
+
+        for (usize i{}; i < _draws.size(); ++i) {
+            if (full_redraw) {
+                _draws[i].draw_fragments(_history[i].fragments, _color_buffer, _depth_buffer, nullptr);
+            } else if (_history[i].coverage.intersects(_dirty_tiles)) {
+                _draws[i].draw_fragments(_history[i].fragments, _color_buffer, _depth_buffer, &_dirty_tiles);
+            }
+        }
+
+        return true;
+    }
+
+    // Every band replays all draws in order, so the result is the same for any number of bands
+    get_worker_pool().run(band_count, [&](u32 band) {
+        TileMask band_tiles{};
+        for (u32 ty = band * tile_rows / band_count; ty < (band + 1u) * tile_rows / band_count; ++ty) {
+            band_tiles.rows[ty] = _dirty_tiles.rows[ty];
+        }
+
+        fill_band(band_tiles);
+    });
+
+    return true;
+}
+
+void RetainedFrame::fill_band(const TileMask &band_tiles) const {
+    if (!band_tiles.any()) {
+        return;
+    }
+
+    if (_color_buffer.valid()) {
+        _color_buffer.fill_tiles(band_tiles, _clear_color);
+    }
+    if (_depth_buffer.valid()) {
+        _depth_buffer.fill_tiles(band_tiles, _clear_depth);
+    }
+
+    for (usize i{}; i < _draws.size(); ++i) {
+        if (_history[i].coverage.intersects(band_tiles)) {
+            _draws[i].draw_fragments(_history[i].fragments, _color_buffer, _depth_buffer, &band_tiles);
+        }
+    }
+}
+
+void RetainedFrame::invalidate() {
+    _valid = false;
+}
+
+u64 RetainedFrame::content_version() const {
+    return _content_version;
+}
+
+const TileMask &RetainedFrame::dirty_tiles() const {
+    return _dirty_tiles;
+}
+
+u32 RetainedFrame::target_width() const {
+    return _color_buffer.valid() ? _color_buffer.width : _depth_buffer.width;
+}
+u32 RetainedFrame::target_height() const {
+    return _color_buffer.valid() ? _color_buffer.height : _depth_buffer.height;
+}
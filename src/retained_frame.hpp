@@ -0,0 +1,164 @@
+#ifndef SIMD_EXPERIMENT_RETAINED_FRAME_HPP
+#define SIMD_EXPERIMENT_RETAINED_FRAME_HPP
+
+#include <span>
+#include <vector>
+#include <type_traits>
+
+#include "raster.hpp"
+#include "raster_pipeline.hpp"
+#include "hash.hpp"
+#include "arena.hpp"
+
+// Retained-mode rendering into a color and/or depth target. Draws are recorded every frame together with a hash of
+// everything they depend on (transforms, uniforms). The shaded fragments of every draw are kept between frames, so
+// only the draws whose hash changed get transformed and shaded again, and only the tiles they touched (before or after
+// the change) get cleared and refilled from the kept fragments.
+// Recording a frame doesn't allocate once the fragment buffers fit: the draws' shaders are copied into an arena that is
+// reset by begin(), and the fill threads come from the shared worker pool.
+class RetainedFrame {
+public:
+    // With more than one fill thread, the fill is split into bands of tile rows filled concurrently on the worker pool.
+    // Fragments spanning several bands are cut into tile-aligned rects, so every thread writes only to its own band.
+    RetainedFrame(const RenderTarget &color_buffer, const RenderTarget &depth_buffer, u32 clear_color, u32 clear_depth, u32 fill_thread_count = 1u);
+
+    // `view_hash` covers the state shared by all draws, e.g. the camera. Changing it redraws the whole frame.
+    void begin(u64 view_hash);
+
+    // The patches have to stay valid until end() is called. Shaders are copied and have to be trivially destructible,
+    // e.g. lambdas capturing pointers and values.
+    template <PipelineState State, typename VertexShader, typename PatchShader>
+    void draw_patches(std::span<const Patch> patches, u64 state_hash, const VertexShader &vertex_shader, const PatchShader &patch_shader);
+
+    // Same as above, but also redraws whenever the mesh version changes
+    template <PipelineState State, typename VertexShader, typename PatchShader>
+    void draw_mesh(const Mesh &mesh, u64 state_hash, const VertexShader &vertex_shader, const PatchShader &patch_shader);
+
+    // Instanced draw, see raster::draw_instanced(). The mesh and the instance transforms have to stay valid until end() is called.
+    template <PipelineState State, typename PatchShader>
+    void draw_instanced(const Mesh &mesh, std::span<const mat4> instance_transforms, const mat4 &view_proj, u64 state_hash, const PatchShader &patch_shader);
+
+    // Single object placed by its model matrix, see raster::draw_model(). The matrices are copied, only the mesh has to stay
+    // valid until end() is called.
+    template <PipelineState State, typename PatchShader>
+    void draw_model(const Mesh &mesh, const mat4 &model, const mat4 &view_proj, u64 state_hash, const PatchShader &patch_shader);
+
+    // Clears and redraws the dirty tiles. Returns false if the framebuffers were left untouched.
+    bool end();
+
+    // Bumped every time end() modifies the framebuffers. Draws sampling them (e.g. a shadow map) should hash it.
+    u64 content_version() const;
+
+    // Forces the next frame to be redrawn completely, e.g. after the framebuffers were written to externally
+    void invalidate();
+
+    const TileMask &dirty_tiles() const;
+
+private:
+    using DrawFragmentsFn = void (*)(std::span<const PatchFragment> fragments, const RenderTarget &color_buffer, const RenderTarget &depth_buffer, const TileMask *tile_mask);
+    using CaptureFn = void (*)(const void *capture, std::vector<PatchFragment> &fragments);
+
+    struct Draw {
+        u64 hash{};
+        DrawFragmentsFn draw_fragments{};
+        // Closure in _captures, called through capture_fn
+        CaptureFn capture_fn{};
+        const void *capture{};
+    };
+    struct DrawHistory {
+        u64 hash{};
+        TileMask coverage{};
+        std::vector<PatchFragment> fragments{};
+    };
+
+    template <typename Capture>
+    void add_draw(u64 hash, DrawFragmentsFn draw_fragments, const Capture &capture);
+
+    void fill_band(const TileMask &band_tiles) const;
+
+    u32 target_width() const;
+    u32 target_height() const;
+
+    RenderTarget _color_buffer{};
+    RenderTarget _depth_buffer{};
+    u32 _clear_color{};
+    u32 _clear_depth{};
+    u32 _fill_thread_count{};
+
+    u64 _view_hash{};
+    u64 _last_view_hash{};
+    u32 _last_width{};
+    u32 _last_height{};
+    bool _valid{};
+    u64 _content_version{};
+
+    TileMask _dirty_tiles{};
+
+    std::vector<Draw> _draws{};
+    std::vector<DrawHistory> _history{};
+
+    // Captures of the current frame's draws
+    Arena _captures{};
+};
+
+template <typename Capture>
+void RetainedFrame::add_draw(u64 hash, DrawFragmentsFn draw_fragments, const Capture &capture) {
+    static_assert(std::is_trivially_destructible_v<Capture>, "Shaders of retained draws have to be trivially destructible!");
+
+    _draws.push_back(Draw{
+        .hash = hash,
+        .draw_fragments = draw_fragments,
+        .capture_fn = [](const void *capture, std::vector<PatchFragment> &fragments) {
+            (*static_cast<const Capture *>(capture))(fragments);
+        },
+        .capture = _captures.create<Capture>(capture)
+    });
+}
+
+template <PipelineState State, typename VertexShader, typename PatchShader>
+void RetainedFrame::draw_patches(std::span<const Patch> patches, u64 state_hash, const VertexShader &vertex_shader, const PatchShader &patch_shader) {
+    DrawFragmentsFn draw_fragments = raster::draw_fragments<State>;
+    u32 width = target_width();
+    u32 height = target_height();
+
+    add_draw(raster::hash_values(state_hash, patches.data(), patches.size(), draw_fragments), draw_fragments, [=](std::vector<PatchFragment> &fragments) {
+        // At most one fragment per patch, the buffer is kept and never grows again
+        fragments.reserve(patches.size());
+        raster::capture_fragments<State>(patches, vertex_shader, patch_shader, width, height, fragments);
+    });
+}
+
+template <PipelineState State, typename VertexShader, typename PatchShader>
+void RetainedFrame::draw_mesh(const Mesh &mesh, u64 state_hash, const VertexShader &vertex_shader, const PatchShader &patch_shader) {
+    draw_patches<State>(mesh.patches, raster::hash_values(state_hash, mesh.version), vertex_shader, patch_shader);
+}
+
+template <PipelineState State, typename PatchShader>
+void RetainedFrame::draw_instanced(const Mesh &mesh, std::span<const mat4> instance_transforms, const mat4 &view_proj, u64 state_hash, const PatchShader &patch_shader) {
+    DrawFragmentsFn draw_fragments = raster::draw_fragments<State>;
+    u32 width = target_width();
+    u32 height = target_height();
+
+    const Mesh *mesh_ptr = &mesh;
+    u64 instances_hash = raster::hash_bytes(instance_transforms.data(), instance_transforms.size_bytes());
+
+    add_draw(raster::hash_values(state_hash, mesh_ptr, mesh.version, instances_hash, view_proj, draw_fragments), draw_fragments, [=](std::vector<PatchFragment> &fragments) {
+        raster::capture_instanced<State>(*mesh_ptr, instance_transforms, view_proj, patch_shader, width, height, fragments);
+    });
+}
+
+template <PipelineState State, typename PatchShader>
+void RetainedFrame::draw_model(const Mesh &mesh, const mat4 &model, const mat4 &view_proj, u64 state_hash, const PatchShader &patch_shader) {
+    DrawFragmentsFn draw_fragments = raster::draw_fragments<State>;
+    u32 width = target_width();
+    u32 height = target_height();
+
+    const Mesh *mesh_ptr = &mesh;
+
+    add_draw(raster::hash_values(state_hash, mesh_ptr, mesh.version, model, view_proj, draw_fragments), draw_fragments, [=](std::vector<PatchFragment> &fragments) {
+        fragments.reserve(mesh_ptr->patches.size());
+        raster::capture_instanced<State>(*mesh_ptr, std::span<const mat4>(&model, 1u), view_proj, patch_shader, width, height, fragments);
+    });
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+#include "scene_generator.hpp"
+
+// NDC depth range of the patches, away from both clip planes
+static constexpr f32 SCENE_NEAR_Z = 0.05f;
+static constexpr f32 SCENE_FAR_Z = 0.95f;
+
+// Patches per write when streaming a ply file
+static constexpr u64 PLY_CHUNK_PATCHES = 1u << 16u;
+
+// SplitMix64, a patch's random values are a pure function of the seed and its index
+struct PatchRandom {
+    u64 state{};
+
+    inline u64 next_u64() {
+        u64 z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31u);
+    }
+
+    // [0, 1)
+    inline f32 next_f32() {
+        return static_cast<f32>(next_u64() >> 40u) * (1.0f / 16777216.0f);
+    }
+};
+
+SceneGenerator::SceneGenerator(const SceneGeneratorConfig &config, u32 viewport_width, u32 viewport_height)
+    : _config(config), _viewport_width(viewport_width), _viewport_height(viewport_height) {
+    assert(config.patch_count > 0u);
+    assert(config.screen_coverage > 0.0f && config.screen_coverage <= 1.0f);
+    assert(config.overdraw > 0.0f);
+    assert(config.size_spread >= 1.0f);
+    assert(viewport_width > 0u && viewport_height > 0u);
+
+    f64 covered_px = static_cast<f64>(config.screen_coverage) * static_cast<f64>(viewport_width) * static_cast<f64>(viewport_height);
+    f64 mean_area_px = static_cast<f64>(config.overdraw) * covered_px / static_cast<f64>(config.patch_count);
+
+    // Both sides are log-uniform in [a, a * k] with mean a * (k - 1) / ln(k), independent of each other, so the mean
+    // area is the square of that
+    f64 k = static_cast<f64>(config.size_spread);
+    f64 mean_side_over_min = k > 1.0 ? (k - 1.0) / std::log(k) : 1.0;
+
+    _min_patch_size_px = static_cast<f32>(std::sqrt(mean_area_px) / mean_side_over_min);
+}
+
+void SceneGenerator::generate(u64 first, std::span<Patch> patches) const {
+    const f32 region = std::sqrt(_config.screen_coverage);
+    const f32 log_spread = std::log(_config.size_spread);
+    const f32 px_to_ndc_x = 2.0f / static_cast<f32>(_viewport_width);
+    const f32 px_to_ndc_y = 2.0f / static_cast<f32>(_viewport_height);
+    const f32 count = static_cast<f32>(_config.patch_count);
+
+    // A side of the patch and the position of its center along one axis, keeping it inside the region if it fits
+    auto place = [&](PatchRandom &random, f32 px_to_ndc, f32 &min, f32 &max) {
+        f32 size = _min_patch_size_px * std::exp(random.next_f32() * log_spread) * px_to_ndc;
+        f32 range = std::max(region * 2.0f - size, 0.0f);
+        f32 center = (random.next_f32() - 0.5f) * range;
+
+        min = center - size * 0.5f;
+        max = center + size * 0.5f;
+    };
+
+    for (usize i{}; i < patches.size(); ++i) {
+        const u64 index = first + i;
+        PatchRandom random{ static_cast<u64>(_config.seed) * 0x100000001B3ull ^ index };
+
+        f32 min_x, max_x, min_y, max_y;
+        place(random, px_to_ndc_x, min_x, max_x);
+        place(random, px_to_ndc_y, min_y, max_y);
+
+        f32 depth_t{};
+        switch (_config.depth_order) {
+            case SceneDepthOrder::Random:
+                depth_t = random.next_f32();
+                break;
+            case SceneDepthOrder::BackToFront:
+                depth_t = 1.0f - (static_cast<f32>(index) + 0.5f) / count;
+                break;
+            case SceneDepthOrder::FrontToBack:
+                depth_t = (static_cast<f32>(index) + 0.5f) / count;
+                break;
+        }
+        f32 z = SCENE_NEAR_Z + (SCENE_FAR_Z - SCENE_NEAR_Z) * depth_t;
+
+        // Whole 8 bit steps, so a ply round trip keeps the colors
+        u64 color_bits = random.next_u64();
+        vec3 color(
+            static_cast<f32>(color_bits & 0xFFu) / 255.0f,
+            static_cast<f32>((color_bits >> 8u) & 0xFFu) / 255.0f,
+            static_cast<f32>((color_bits >> 16u) & 0xFFu) / 255.0f
+        );
+
+        // Three corners of the rect, so the bounding box is the rect itself. Positive signed area, CCW.
+        patches[i] = Patch{
+            .pos = {
+                vec4(min_x, min_y, z, 1.0f),
+                vec4(max_x, min_y, z, 1.0f),
+                vec4(max_x, max_y, z, 1.0f)
+            },
+            .normal = vec3(0.0f, 0.0f, -1.0f),
+            .color = color
+        };
+    }
+}
+
+void SceneGenerator::generate(Mesh &mesh, u32 thread_count) const {
+    mesh.patches.resize(static_cast<usize>(_config.patch_count));
+
+    if (thread_count == 0u) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    const u64 chunk = (_config.patch_count + thread_count - 1u) / thread_count;
+
+    std::vector<std::thread> threads{};
+    for (u64 first = chunk; first < _config.patch_count; first += chunk) {
+        u64 count = std::min(chunk, _config.patch_count - first);
+
+        threads.emplace_back([this, &mesh, first, count]() {
+            generate(first, std::span<Patch>(mesh.patches).subspan(static_cast<usize>(first), static_cast<usize>(count)));
+        });
+    }
+
+    // The first chunk on the calling thread
+    generate(0u, std::span<Patch>(mesh.patches).subspan(0u, static_cast<usize>(std::min(chunk, _config.patch_count))));
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    mesh.mark_modified();
+}
+
+bool SceneGenerator::write_ply(const std::string &path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    file << "ply\nformat binary_little_endian 1.0\n"
+         << "element vertex " << _config.patch_count * 3u << "\n"
+         << "property float x\nproperty float y\nproperty float z\n"
+         << "property float nx\nproperty float ny\nproperty float nz\n"
+         << "property uchar red\nproperty uchar green\nproperty uchar blue\nproperty uchar alpha\n"
+         << "element face " << _config.patch_count << "\n"
+         << "property list uchar uint vertex_indices\n"
+         << "end_header\n";
+
+    // Packed like the file, 28 bytes per vertex and 13 bytes per face
+    struct PlyVertex {
+        f32 position[3]{};
+        f32 normal[3]{};
+        u8 color[4]{};
+    };
+    static_assert(sizeof(PlyVertex) == 28u);
+
+    std::vector<Patch> patches{};
+    std::vector<PlyVertex> vertices{};
+
+    // The vertices come first, the faces only need their indices
+    for (u64 first{}; first < _config.patch_count; first += PLY_CHUNK_PATCHES) {
+        u64 count = std::min(PLY_CHUNK_PATCHES, _config.patch_count - first);
+
+        patches.resize(static_cast<usize>(count));
+        generate(first, patches);
+
+        vertices.clear();
+        for (const Patch &patch : patches) {
+            u8 color[4]{
+                static_cast<u8>(std::lround(patch.color.x * 255.0f)),
+                static_cast<u8>(std::lround(patch.color.y * 255.0f)),
+                static_cast<u8>(std::lround(patch.color.z * 255.0f)),
+                255u
+            };
+
+            for (const vec4 &pos : patch.pos) {
+                // ply_import() mirrors x, undone here
+                vertices.push_back(PlyVertex{
+                    .position = { -pos.x, pos.y, pos.z },
+                    .normal = { patch.normal.x, patch.normal.y, patch.normal.z },
+                    .color = { color[0], color[1], color[2], color[3] }
+                });
+            }
+        }
+
+        file.write(reinterpret_cast<const char *>(vertices.data()), static_cast<std::streamsize>(vertices.size() * sizeof(PlyVertex)));
+    }
+
+    std::vector<char> faces{};
+    for (u64 first{}; first < _config.patch_count; first += PLY_CHUNK_PATCHES) {
+        u64 count = std::min(PLY_CHUNK_PATCHES, _config.patch_count - first);
+
+        faces.resize(static_cast<usize>(count) * 13u);
+        for (u64 i{}; i < count; ++i) {
+            u32 v0 = static_cast<u32>((first + i) * 3u);
+
+            // ply_import() reverses the winding along with the mirror, so the indices are stored reversed as well
+            u32 indices[3]{ v0 + 2u, v0 + 1u, v0 };
+
+            faces[static_cast<usize>(i) * 13u] = 3;
+            std::memcpy(&faces[static_cast<usize>(i) * 13u + 1u], indices, sizeof(indices));
+        }
+
+        file.write(faces.data(), static_cast<std::streamsize>(faces.size()));
+    }
+
+    return file.good();
+}
+
+f32 SceneGenerator::min_patch_size_px() const {
+    return _min_patch_size_px;
+}
+
+const SceneGeneratorConfig &SceneGenerator::config() const {
+    return _config;
+}
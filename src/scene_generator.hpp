@@ -0,0 +1,67 @@
+#ifndef SIMD_EXPERIMENT_SCENE_GENERATOR_HPP
+#define SIMD_EXPERIMENT_SCENE_GENERATOR_HPP
+
+#include <span>
+#include <string>
+
+#include "raster.hpp"
+
+enum class SceneDepthOrder {
+    Random,
+    // Every patch is behind the previous ones, the depth test rejects nothing
+    BackToFront,
+    // Every patch is in front of the previous ones, overdraw is rejected by early-Z
+    FrontToBack
+};
+
+struct SceneGeneratorConfig {
+    u64 patch_count = 100000u;
+
+    // Fraction of the viewport the patches are placed in, a centered rect with the viewport's aspect ratio
+    f32 screen_coverage = 1.0f;
+
+    // Average number of patches over a pixel of the covered area, by their exact area. Together with the patch count and
+    // the coverage it sets the mean patch area. The rasterized rects are rounded out, which adds up to a pixel per side.
+    f32 overdraw = 2.0f;
+
+    // Largest over smallest patch side length, sides are log-uniform in between. 1 gives every patch the same size.
+    f32 size_spread = 8.0f;
+
+    SceneDepthOrder depth_order = SceneDepthOrder::Random;
+
+    u32 seed = 1u;
+};
+
+// Procedural patch soup for scaling measurements. The patches are generated directly in NDC and have to be drawn with
+// an identity view-projection matrix, so their sizes, coverage and overdraw in pixels are exact for the viewport the
+// generator was created for. Every patch is an axis aligned right triangle facing the camera with CCW winding.
+// Patch i only depends on the seed and i, so any range can be generated on its own, e.g. in chunks or on several threads.
+class SceneGenerator {
+public:
+    SceneGenerator(const SceneGeneratorConfig &config, u32 viewport_width, u32 viewport_height);
+
+    // Patches [first, first + patches.size())
+    void generate(u64 first, std::span<Patch> patches) const;
+
+    // The whole scene, `thread_count` of 0 uses every hardware thread
+    void generate(Mesh &mesh, u32 thread_count = 0u) const;
+
+    // Binary ply in the layout ply_import() reads, written in chunks so scenes larger than memory can be written.
+    // Importing it gives the same patches up to the 8 bit colors.
+    bool write_ply(const std::string &path) const;
+
+    // Side length of the smallest patches in pixels, the largest ones are size_spread times as long
+    f32 min_patch_size_px() const;
+
+    const SceneGeneratorConfig &config() const;
+
+private:
+    SceneGeneratorConfig _config{};
+
+    u32 _viewport_width{};
+    u32 _viewport_height{};
+
+    f32 _min_patch_size_px{};
+};
+
+#endif
@@ -0,0 +1,350 @@
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+#include "shadow_cascades.hpp"
+#include "worker_pool.hpp"
+
+// Largest float below 1.0, so that the depth never wraps around when converted to u32
+static constexpr f32 MAX_SHADOW_DEPTH = 0.99999994f;
+
+ShadowCascades::ShadowCascades(const ShadowCascadesConfig &config) : _config(config) {
+    assert(config.cascade_count >= 1u && config.cascade_count <= SHADOW_MAX_CASCADES);
+    assert(config.resolution <= RASTER_MAX_FB_WIDTH && config.resolution <= RASTER_MAX_FB_HEIGHT && "Every cascade has to fit into a render target!");
+
+    _depth_maps.resize(static_cast<usize>(_config.resolution) * _config.resolution * _config.cascade_count);
+
+    for (u32 cascade{}; cascade < _config.cascade_count; ++cascade) {
+        _frames.emplace_back(RenderTarget{}, cascade_target(cascade), 0u, UINT32_MAX);
+    }
+}
+
+void ShadowCascades::begin(const vec3 &camera_position, const vec3 &camera_target, f32 fov_y, f32 aspect, f32 near_plane, const vec3 &light_direction) {
+    vec3 forward = (camera_target - camera_position).normalized();
+    vec3 right = math::WORLD_UP.cross(forward).normalized();
+    vec3 up = forward.cross(right);
+
+    _camera_position = camera_position;
+    _camera_forward = forward;
+
+    f32 tan_half_fov = math::tan(fov_y / 2.0f);
+    f32 far_plane = _config.max_distance;
+    f32 count_f = static_cast<f32>(_config.cascade_count);
+
+    // Only rotates, the translation gets fitted per cascade
+    mat4 light_rotation = mat4::look_at(light_direction, vec3(0.0f));
+
+    f32 slice_near = near_plane;
+    for (u32 cascade{}; cascade < _config.cascade_count; ++cascade) {
+        f32 t = static_cast<f32>(cascade + 1u) / count_f;
+        f32 log_split = near_plane * std::pow(far_plane / near_plane, t);
+        f32 uniform_split = near_plane + (far_plane - near_plane) * t;
+        f32 slice_far = _config.split_lambda * log_split + (1.0f - _config.split_lambda) * uniform_split;
+
+        vec3 corners[8]{};
+        vec3 center{};
+        for (u32 i{}; i < 8u; ++i) {
+            f32 depth = (i & 4u) ? slice_far : slice_near;
+            f32 half_h = depth * tan_half_fov;
+            f32 half_w = half_h * aspect;
+
+            corners[i] = camera_position + forward * depth + right * ((i & 1u) ? half_w : -half_w) + up * ((i & 2u) ? half_h : -half_h);
+            center = center + corners[i];
+        }
+        center = center / 8.0f;
+
+        // A bounding sphere keeps the cascade size constant while the camera rotates
+        f32 radius{};
+        for (const vec3 &corner : corners) {
+            radius = std::max(radius, (corner - center).magnitude());
+        }
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // Snapping the center to whole texels stops the shadow edges from shimmering while the camera moves
+        f32 texel_size = (2.0f * radius) / static_cast<f32>(_config.resolution);
+        vec4 center_ls = light_rotation * vec4(center, 1.0f);
+
+        mat4 light_view = light_rotation;
+        light_view.m[3][0] -= std::floor(center_ls.x / texel_size) * texel_size;
+        light_view.m[3][1] -= std::floor(center_ls.y / texel_size) * texel_size;
+        light_view.m[3][2] += -(radius + _config.caster_distance) - center_ls.z;
+
+        mat4 light_proj = mat4::orthogonal(2.0f * radius, 2.0f * radius, 0.0f, 2.0f * radius + _config.caster_distance);
+
+        _proj_views[cascade] = light_proj * light_view;
+        _split_far[cascade] = slice_far;
+
+        _frames[cascade].begin(raster::hash_values(_proj_views[cascade]));
+
+        slice_near = slice_far;
+    }
+}
+
+void ShadowCascades::end() {
+    get_worker_pool().run(_config.cascade_count, [this](u32 cascade) {
+        _frames[cascade].end();
+    });
+}
+
+f32 ShadowCascades::visibility(const vec4 &world_position) const {
+    f32 view_depth = _camera_forward.dot(world_position.xyz() - _camera_position);
+
+    u32 cascade{};
+    while (cascade < _config.cascade_count && view_depth >= _split_far[cascade]) {
+        ++cascade;
+    }
+
+    if (cascade == _config.cascade_count) {
+        return 1.0f;
+    }
+
+    // Orthographic, w stays 1.0
+    vec4 shadow_ndc = _proj_views[cascade] * world_position;
+
+    f32 u = shadow_ndc.x * 0.5f + 0.5f;
+    f32 v = shadow_ndc.y * 0.5f + 0.5f;
+    if (!(u >= 0.0f && u < 1.0f && v >= 0.0f && v < 1.0f)) {
+        return 1.0f;
+    }
+
+    f32 resolution_f = static_cast<f32>(_config.resolution);
+    i32 max_texel = static_cast<i32>(_config.resolution) - 1;
+
+    u32 depth32 = static_cast<u32>(std::clamp(shadow_ndc.z - _config.depth_bias, 0.0f, MAX_SHADOW_DEPTH) * static_cast<f32>(UINT32_MAX));
+
+    const u32 *depth_map = _depth_maps.data() + static_cast<usize>(cascade) * _config.resolution * _config.resolution;
+
+    if (!_config.enable_pcf) {
+        // u < 1.0 can still round up to the resolution after the multiplication
+        u32 x = static_cast<u32>(std::min(static_cast<i32>(u * resolution_f), max_texel));
+        u32 y = static_cast<u32>(std::min(static_cast<i32>(v * resolution_f), max_texel));
+
+        return depth_map[y * _config.resolution + x] < depth32 ? 0.0f : 1.0f;
+    }
+
+    // The four texels whose centers surround the sample position, clamped to the edges of the map
+    i32 x0 = static_cast<i32>(std::floor(u * resolution_f - 0.5f));
+    i32 y0 = static_cast<i32>(std::floor(v * resolution_f - 0.5f));
+
+    u32 xs[2] = { static_cast<u32>(std::clamp(x0, 0, max_texel)), static_cast<u32>(std::clamp(x0 + 1, 0, max_texel)) };
+    u32 ys[2] = { static_cast<u32>(std::clamp(y0, 0, max_texel)), static_cast<u32>(std::clamp(y0 + 1, 0, max_texel)) };
+
+    f32 lit{};
+    for (u32 y : ys) {
+        for (u32 x : xs) {
+            lit += depth_map[y * _config.resolution + x] < depth32 ? 0.0f : 0.25f;
+        }
+    }
+
+    return lit;
+}
+
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+__m256 ShadowCascades::visibility_packet(__m256 px, __m256 py, __m256 pz, __m256 pw) const {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 resolution_f = _mm256_set1_ps(static_cast<f32>(_config.resolution));
+    const __m256 max_depth = _mm256_set1_ps(MAX_SHADOW_DEPTH);
+    const __m256 max_depth32 = _mm256_set1_ps(static_cast<f32>(UINT32_MAX));
+    const __m256 two_pow_31 = _mm256_set1_ps(2147483648.0f);
+    const __m256i sign_bit = _mm256_set1_epi32(static_cast<i32>(0x80000000u));
+    const __m256i resolution_i = _mm256_set1_epi32(static_cast<i32>(_config.resolution));
+    const __m256i max_texel = _mm256_set1_epi32(static_cast<i32>(_config.resolution) - 1);
+    const __m256i zero_i = _mm256_setzero_si256();
+
+    const i32 *depth_maps = reinterpret_cast<const i32 *>(_depth_maps.data());
+
+    __m256 view_depth = _mm256_add_ps(
+        _mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(px, _mm256_set1_ps(_camera_position.x)), _mm256_set1_ps(_camera_forward.x)),
+            _mm256_mul_ps(_mm256_sub_ps(py, _mm256_set1_ps(_camera_position.y)), _mm256_set1_ps(_camera_forward.y))
+        ),
+        _mm256_mul_ps(_mm256_sub_ps(pz, _mm256_set1_ps(_camera_position.z)), _mm256_set1_ps(_camera_forward.z))
+    );
+
+    // Cascade selection: count the splits each position lies beyond, then pick that cascade's transform per lane
+    __m256i cascade = _mm256_setzero_si256();
+    __m256 nx = zero, ny = zero, nz = zero;
+
+    for (u32 c{}; c < _config.cascade_count; ++c) {
+        __m256 beyond = _mm256_cmp_ps(view_depth, _mm256_set1_ps(_split_far[c]), _CMP_GE_OQ);
+        __m256 selected = _mm256_castsi256_ps(_mm256_cmpeq_epi32(cascade, _mm256_set1_epi32(static_cast<i32>(c))));
+
+        const mat4 &m = _proj_views[c];
+        __m256 cx = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.m[0][0]), px), _mm256_mul_ps(_mm256_set1_ps(m.m[1][0]), py)),
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.m[2][0]), pz), _mm256_mul_ps(_mm256_set1_ps(m.m[3][0]), pw))
+        );
+        __m256 cy = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.m[0][1]), px), _mm256_mul_ps(_mm256_set1_ps(m.m[1][1]), py)),
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.m[2][1]), pz), _mm256_mul_ps(_mm256_set1_ps(m.m[3][1]), pw))
+        );
+        __m256 cz = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.m[0][2]), px), _mm256_mul_ps(_mm256_set1_ps(m.m[1][2]), py)),
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m.m[2][2]), pz), _mm256_mul_ps(_mm256_set1_ps(m.m[3][2]), pw))
+        );
+
+        nx = _mm256_blendv_ps(nx, cx, selected);
+        ny = _mm256_blendv_ps(ny, cy, selected);
+        nz = _mm256_blendv_ps(nz, cz, selected);
+
+        cascade = _mm256_sub_epi32(cascade, _mm256_and_si256(_mm256_castps_si256(beyond), _mm256_castps_si256(selected)));
+    }
+
+    __m256 u = _mm256_add_ps(_mm256_mul_ps(nx, half), half);
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(ny, half), half);
+
+    __m256 inside = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LT_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LT_OQ))
+    );
+    inside = _mm256_and_ps(inside, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<i32>(_config.cascade_count)), cascade)));
+
+    // f32 -> u32 conversion, exact like the scalar cast on both halves of the range
+    __m256 depth_f = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(nz, _mm256_set1_ps(_config.depth_bias)), zero), max_depth), max_depth32);
+    __m256i depth_lo = _mm256_cvttps_epi32(depth_f);
+    __m256i depth_hi = _mm256_xor_si256(_mm256_cvttps_epi32(_mm256_sub_ps(depth_f, two_pow_31)), sign_bit);
+    __m256i depth32 = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(depth_lo), _mm256_castsi256_ps(depth_hi), _mm256_cmp_ps(depth_f, two_pow_31, _CMP_GE_OQ)));
+    __m256i depth32_signed = _mm256_xor_si256(depth32, sign_bit);
+
+    __m256i map_offset = _mm256_mullo_epi32(_mm256_mullo_epi32(cascade, resolution_i), resolution_i);
+
+    // Out of bounds lanes are masked off and never read. Returns all ones where the stored depth is in front.
+    auto shadow_test = [&](__m256i x, __m256i y) {
+        __m256i offset = _mm256_add_epi32(_mm256_add_epi32(map_offset, _mm256_mullo_epi32(y, resolution_i)), x);
+        __m256i stored = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), depth_maps, offset, _mm256_castps_si256(inside), 4);
+
+        // Unsigned stored < depth32
+        return _mm256_castsi256_ps(_mm256_cmpgt_epi32(depth32_signed, _mm256_xor_si256(stored, sign_bit)));
+    };
+
+    if (!_config.enable_pcf) {
+        __m256i x = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(u, resolution_f)), max_texel);
+        __m256i y = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(v, resolution_f)), max_texel);
+
+        __m256 shadowed = _mm256_and_ps(shadow_test(x, y), inside);
+
+        return _mm256_andnot_ps(shadowed, one);
+    }
+
+    __m256i x0 = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_sub_ps(_mm256_mul_ps(u, resolution_f), half)));
+    __m256i y0 = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_sub_ps(_mm256_mul_ps(v, resolution_f), half)));
+    __m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(1));
+    __m256i y1 = _mm256_add_epi32(y0, _mm256_set1_epi32(1));
+
+    x0 = _mm256_min_epi32(_mm256_max_epi32(x0, zero_i), max_texel);
+    y0 = _mm256_min_epi32(_mm256_max_epi32(y0, zero_i), max_texel);
+    x1 = _mm256_min_epi32(_mm256_max_epi32(x1, zero_i), max_texel);
+    y1 = _mm256_min_epi32(_mm256_max_epi32(y1, zero_i), max_texel);
+
+    // Same order of additions as the scalar path, all partial sums are exact anyway
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    __m256 lit = _mm256_andnot_ps(shadow_test(x0, y0), quarter);
+    lit = _mm256_add_ps(lit, _mm256_andnot_ps(shadow_test(x1, y0), quarter));
+    lit = _mm256_add_ps(lit, _mm256_andnot_ps(shadow_test(x0, y1), quarter));
+    lit = _mm256_add_ps(lit, _mm256_andnot_ps(shadow_test(x1, y1), quarter));
+
+    return _mm256_blendv_ps(one, lit, inside);
+}
+#endif
+
+void ShadowCascades::visibility(std::span<const vec4> world_positions, std::span<f32> visibilities) const {
+    assert(visibilities.size() >= world_positions.size());
+
+    usize i{};
+
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+    for (; i + 8u <= world_positions.size(); i += 8u) {
+        // AoS -> SoA, two 4x4 transposes
+        __m128 r0 = _mm_load_ps(&world_positions[i + 0u].x);
+        __m128 r1 = _mm_load_ps(&world_positions[i + 1u].x);
+        __m128 r2 = _mm_load_ps(&world_positions[i + 2u].x);
+        __m128 r3 = _mm_load_ps(&world_positions[i + 3u].x);
+        __m128 r4 = _mm_load_ps(&world_positions[i + 4u].x);
+        __m128 r5 = _mm_load_ps(&world_positions[i + 5u].x);
+        __m128 r6 = _mm_load_ps(&world_positions[i + 6u].x);
+        __m128 r7 = _mm_load_ps(&world_positions[i + 7u].x);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+
+        __m256 px = _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r4, 1);
+        __m256 py = _mm256_insertf128_ps(_mm256_castps128_ps256(r1), r5, 1);
+        __m256 pz = _mm256_insertf128_ps(_mm256_castps128_ps256(r2), r6, 1);
+        __m256 pw = _mm256_insertf128_ps(_mm256_castps128_ps256(r3), r7, 1);
+
+        _mm256_storeu_ps(&visibilities[i], visibility_packet(px, py, pz, pw));
+    }
+#endif
+
+    for (; i < world_positions.size(); ++i) {
+        visibilities[i] = visibility(world_positions[i]);
+    }
+}
+
+void ShadowCascades::patch_visibility(const Mesh &mesh, const mat4 &model, std::span<f32> visibilities) const {
+    const PatchCenters &centers = mesh.centers;
+    const usize patch_count = centers.x.size();
+
+    assert(patch_count == mesh.patches.size() && "The mesh's centers are stale, call mark_modified()!");
+    assert(visibilities.size() >= patch_count);
+
+    usize i{};
+
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+    __m256 m[4][4]{};
+    for (u32 col{}; col < 4u; ++col) {
+        for (u32 row{}; row < 4u; ++row) {
+            m[col][row] = _mm256_set1_ps(model.m[col][row]);
+        }
+    }
+
+    for (; i + 8u <= patch_count; i += 8u) {
+        __m256 cx = _mm256_loadu_ps(&centers.x[i]);
+        __m256 cy = _mm256_loadu_ps(&centers.y[i]);
+        __m256 cz = _mm256_loadu_ps(&centers.z[i]);
+
+        // The centers' w is 1.0, same order of operations as mat4 * vec4
+        __m256 p[4]{};
+        for (u32 row{}; row < 4u; ++row) {
+            p[row] = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(m[0][row], cx), _mm256_mul_ps(m[1][row], cy)),
+                _mm256_add_ps(_mm256_mul_ps(m[2][row], cz), m[3][row])
+            );
+        }
+
+        _mm256_storeu_ps(&visibilities[i], visibility_packet(p[0], p[1], p[2], p[3]));
+    }
+#endif
+
+    for (; i < patch_count; ++i) {
+        visibilities[i] = visibility(model * vec4(centers.x[i], centers.y[i], centers.z[i], 1.0f));
+    }
+}
+
+u64 ShadowCascades::content_version() const {
+    u64 hash = raster::HASH_SEED;
+    for (const RetainedFrame &frame : _frames) {
+        u64 version = frame.content_version();
+        hash = raster::hash_bytes(&version, sizeof(version), hash);
+    }
+
+    return hash;
+}
+
+u32 ShadowCascades::cascade_count() const {
+    return _config.cascade_count;
+}
+const mat4 &ShadowCascades::cascade_proj_view(u32 cascade) const {
+    return _proj_views[cascade];
+}
+f32 ShadowCascades::cascade_far(u32 cascade) const {
+    return _split_far[cascade];
+}
+RenderTarget ShadowCascades::cascade_target(u32 cascade) {
+    return RenderTarget{
+        .data = _depth_maps.data() + static_cast<usize>(cascade) * _config.resolution * _config.resolution,
+        .width = _config.resolution,
+        .height = _config.resolution
+    };
+}
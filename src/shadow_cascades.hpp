@@ -0,0 +1,113 @@
+#ifndef SIMD_EXPERIMENT_SHADOW_CASCADES_HPP
+#define SIMD_EXPERIMENT_SHADOW_CASCADES_HPP
+
+#include <span>
+#include <array>
+#include <vector>
+
+#include "raster.hpp"
+#include "raster_pipeline.hpp"
+#include "retained_frame.hpp"
+#include "hash.hpp"
+
+static constexpr u32 SHADOW_MAX_CASCADES = 4u;
+
+struct ShadowCascadesConfig {
+    u32 cascade_count = 3u;
+    u32 resolution = 256u;
+
+    // Shadows end at this distance from the camera
+    f32 max_distance = 20.0f;
+
+    // Blends between uniform (0.0) and logarithmic (1.0) split distances
+    f32 split_lambda = 0.75f;
+
+    // How far towards the light a cascade still picks up shadow casters
+    f32 caster_distance = 40.0f;
+
+    f32 depth_bias = 0.01f;
+
+    // 2x2 percentage closer filtering: averages the depth tests of the four texels around the sample position, which
+    // softens the edges to quarter steps. Off samples the nearest texel only.
+    bool enable_pcf = false;
+};
+
+// Cascaded shadow maps fitted to slices of the camera frustum. Every cascade has its own depth target and retained frame,
+// so unchanged cascades are not redrawn and the changed ones are rendered concurrently on the worker pool.
+class ShadowCascades {
+public:
+    explicit ShadowCascades(const ShadowCascadesConfig &config);
+
+    // Fits the cascades to the camera frustum and starts recording the shadow casters of a new frame
+    void begin(const vec3 &camera_position, const vec3 &camera_target, f32 fov_y, f32 aspect, f32 near_plane, const vec3 &light_direction);
+
+    // `make_vertex_shader` is called with every cascade's projection * view matrix and returns the vertex shader for it
+    template <PipelineState State, typename MakeVertexShader>
+    void draw_mesh(const Mesh &mesh, u64 state_hash, const MakeVertexShader &make_vertex_shader);
+
+    // Shadow caster placed by its model matrix, drawn through the instanced path with the model folded into every
+    // cascade's projection * view matrix
+    template <PipelineState State>
+    void draw_model(const Mesh &mesh, const mat4 &model, u64 state_hash);
+
+    // Renders the cascades concurrently on the worker pool
+    void end();
+
+    // 0.0 if the world position is in shadow, 1.0 otherwise. Positions outside of all cascades are lit.
+    f32 visibility(const vec4 &world_position) const;
+
+    // Same as above for many positions at once, 8 at a time with SIMD
+    void visibility(std::span<const vec4> world_positions, std::span<f32> visibilities) const;
+
+    // Visibility of every patch's center, placed by the model matrix, in packets of 8 patches straight from the mesh's
+    // center streams. Run once per draw before shading, so the patch shader only has to read its patch's entry instead
+    // of doing the lookup itself.
+    void patch_visibility(const Mesh &mesh, const mat4 &model, std::span<f32> visibilities) const;
+
+    // Changes whenever any cascade gets redrawn, draws sampling the cascades should hash it
+    u64 content_version() const;
+
+    u32 cascade_count() const;
+    const mat4 &cascade_proj_view(u32 cascade) const;
+    f32 cascade_far(u32 cascade) const;
+    RenderTarget cascade_target(u32 cascade);
+
+private:
+#if defined(MATH_ENABLE_SIMD) && defined(MATH_SIMD_AVX)
+    // The lookup for 8 world positions in SoA layout
+    __m256 visibility_packet(__m256 px, __m256 py, __m256 pz, __m256 pw) const;
+#endif
+
+    ShadowCascadesConfig _config{};
+
+    // All cascades are stored one after another, so that one gather can sample any of them. Not a framebuffer, together
+    // they can be taller than any render target, only each cascade on its own has to fit into one.
+    std::vector<u32> _depth_maps{};
+    std::vector<RetainedFrame> _frames{};
+
+    std::array<mat4, SHADOW_MAX_CASCADES> _proj_views{};
+    std::array<f32, SHADOW_MAX_CASCADES> _split_far{};
+
+    vec3 _camera_position{};
+    vec3 _camera_forward{};
+};
+
+template <PipelineState State, typename MakeVertexShader>
+void ShadowCascades::draw_mesh(const Mesh &mesh, u64 state_hash, const MakeVertexShader &make_vertex_shader) {
+    static_assert(!State.enable_color && State.enable_depth, "Shadow casters can only be drawn with depth-only pipelines!");
+
+    for (u32 cascade{}; cascade < _config.cascade_count; ++cascade) {
+        _frames[cascade].draw_mesh<State>(mesh, state_hash, make_vertex_shader(_proj_views[cascade]), raster::null_patch_shader);
+    }
+}
+
+template <PipelineState State>
+void ShadowCascades::draw_model(const Mesh &mesh, const mat4 &model, u64 state_hash) {
+    static_assert(!State.enable_color && State.enable_depth, "Shadow casters can only be drawn with depth-only pipelines!");
+
+    for (u32 cascade{}; cascade < _config.cascade_count; ++cascade) {
+        _frames[cascade].draw_model<State>(mesh, model, _proj_views[cascade], state_hash, raster::null_patch_shader);
+    }
+}
+
+#endif
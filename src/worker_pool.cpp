@@ -0,0 +1,129 @@
+#include <algorithm>
+
+#include "worker_pool.hpp"
+#include "allocation_counter.hpp"
+
+// Set while the thread runs a task, nested run() calls don't wait for the pool then
+static thread_local bool t_in_task{};
+
+WorkerPool::WorkerPool(u32 thread_count) {
+    _threads.reserve(thread_count);
+    for (u32 i{}; i < thread_count; ++i) {
+        _threads.emplace_back([this]() {
+            worker_loop();
+        });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+
+    for (std::thread &thread : _threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::run(u32 count, TaskFn task_fn, const void *task) {
+    if (count == 0u) {
+        return;
+    }
+
+    if (count == 1u || t_in_task || _threads.empty()) {
+        bool was_in_task = t_in_task;
+        t_in_task = true;
+
+        for (u32 i{}; i < count; ++i) {
+            task_fn(task, i);
+        }
+
+        t_in_task = was_in_task;
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(_run_mutex);
+
+    {
+        // Workers that woke up too late for the previous job may still be looking at it
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_condition.wait(lock, [&]() {
+            return _busy == 0u;
+        });
+
+        _task_fn = task_fn;
+        _task = task;
+        _count = count;
+        _count_allocations = allocation_counter::is_counting();
+        _next.store(0u, std::memory_order_relaxed);
+        ++_job;
+    }
+    _condition.notify_all();
+
+    t_in_task = true;
+    run_tasks(task_fn, task, count);
+    t_in_task = false;
+
+    // All indices are taken, wait for the workers still running theirs
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_condition.wait(lock, [&]() {
+        return _busy == 0u;
+    });
+}
+
+void WorkerPool::run_tasks(TaskFn task_fn, const void *task, u32 count) {
+    for (u32 i = _next.fetch_add(1u, std::memory_order_relaxed); i < count; i = _next.fetch_add(1u, std::memory_order_relaxed)) {
+        task_fn(task, i);
+    }
+}
+
+void WorkerPool::worker_loop() {
+    t_in_task = true;
+
+    u64 job{};
+    for (;;) {
+        TaskFn task_fn{};
+        const void *task{};
+        u32 count{};
+        bool count_allocations{};
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [&]() {
+                return _stop || _job != job;
+            });
+
+            if (_stop) {
+                return;
+            }
+
+            job = _job;
+            task_fn = _task_fn;
+            task = _task;
+            count = _count;
+            count_allocations = _count_allocations;
+            ++_busy;
+        }
+
+        allocation_counter::set_counting(count_allocations);
+        run_tasks(task_fn, task, count);
+        allocation_counter::set_counting(false);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_busy;
+        }
+        _done_condition.notify_all();
+    }
+}
+
+u32 WorkerPool::thread_count() const {
+    return static_cast<u32>(_threads.size());
+}
+
+WorkerPool &get_worker_pool() {
+    static WorkerPool worker_pool(std::max(std::thread::hardware_concurrency(), 1u) - 1u);
+    return worker_pool;
+}
@@ -0,0 +1,67 @@
+#ifndef SIMD_EXPERIMENT_WORKER_POOL_HPP
+#define SIMD_EXPERIMENT_WORKER_POOL_HPP
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "types.hpp"
+
+// Persistent threads for the fork-join parts of a frame (fill bands, shadow cascades, command list chains), so that
+// frames don't create threads. run() spreads the tasks over the workers and the calling thread and returns once all of
+// them finished. It doesn't allocate, the task is only referenced for the duration of the call.
+class WorkerPool {
+public:
+    // The calling thread always helps, so `thread_count` of 0 runs everything on it
+    explicit WorkerPool(u32 thread_count);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Calls task(i) for every i in [0, count), in any order and concurrently. run() from inside a task (e.g. a cascade
+    // filling its bands) runs serially on the calling thread. Concurrent run() calls from other threads take turns.
+    template <typename Task>
+    void run(u32 count, const Task &task);
+
+    u32 thread_count() const;
+
+private:
+    using TaskFn = void (*)(const void *task, u32 index);
+
+    void run(u32 count, TaskFn task_fn, const void *task);
+    void run_tasks(TaskFn task_fn, const void *task, u32 count);
+    void worker_loop();
+
+    std::mutex _run_mutex{};
+
+    std::mutex _mutex{};
+    std::condition_variable _condition{};
+    std::condition_variable _done_condition{};
+
+    // The current job, only changed while no worker is in it
+    TaskFn _task_fn{};
+    const void *_task{};
+    u32 _count{};
+    bool _count_allocations{};
+    u64 _job{};
+    std::atomic<u32> _next{};
+    u32 _busy{};
+    bool _stop{};
+
+    std::vector<std::thread> _threads{};
+};
+
+template <typename Task>
+void WorkerPool::run(u32 count, const Task &task) {
+    run(count, [](const void *task, u32 index) {
+        (*static_cast<const Task *>(task))(index);
+    }, &task);
+}
+
+// Shared pool with a worker for every hardware thread but the calling one, started on the first call
+WorkerPool &get_worker_pool();
+
+#endif